@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+#include "arena.h"
+#endif
+
+// round_up() rounds a size up to a whole number of arena_align units
+static size_t round_up(size_t sz){
+    return (sz + sizeof(union arena_align) - 1) / sizeof(union arena_align) * sizeof(union arena_align);
+}
+
+// arena_alloc() returns sz bytes from the arena, adding a block if the current
+// one is full. Blocks double in size, so a listing of n rows needs O(log n) of
+// them. Returns NULL if a block could not be malloc'd.
+void *arena_alloc(struct arena *a, size_t sz){
+    struct arena_block *b = a->head;
+    size_t cap;
+    void *p;
+
+    sz = round_up(sz);
+    if (b == NULL || b->cap - b->used < sz){
+        cap = (b == NULL) ? ARENA_BLOCK_SZ : b->cap*2;
+        if (cap < sz){
+            cap = round_up(sz);
+        }
+        if ((b = malloc(sizeof(struct arena_block) + cap)) == NULL){
+            return NULL;
+        }
+        b->next = a->head;
+        b->cap = cap;
+        b->used = 0;
+        a->head = b;
+        a->blocks++;
+    }
+    p = (char*)b->data + b->used;
+    b->used += sz;
+    return p;
+}
+
+// arena_grow() resizes the allocation p of old_sz bytes to new_sz bytes. If p
+// is the latest allocation and its block has room it grows in place, and
+// otherwise it is copied to a new allocation and the old one is left unused
+// until the arena is reset. Returns NULL if the arena could not grow.
+void *arena_grow(struct arena *a, void *p, size_t old_sz, size_t new_sz){
+    struct arena_block *b = a->head;
+    void *q;
+
+    old_sz = round_up(old_sz);
+    if (p != NULL && b != NULL && (char*)p + old_sz == (char*)b->data + b->used
+        && b->cap - b->used + old_sz >= round_up(new_sz)){
+        b->used += round_up(new_sz) - old_sz;
+        return p;
+    }
+    if ((q = arena_alloc(a, new_sz)) != NULL && p != NULL){
+        memcpy(q, p, old_sz < new_sz ? old_sz : new_sz);
+    }
+    return q;
+}
+
+// arena_strndup() copies l bytes of s into the arena as a string. s may be
+// NULL, for a NULL column, which gives an empty string.
+char *arena_strndup(struct arena *a, const char *s, size_t l){
+    char *d;
+
+    if ((d = arena_alloc(a, l+1)) == NULL){
+        return NULL;
+    }
+    if (s != NULL){
+        memcpy(d, s, l);
+    }
+    d[l] = '\0';
+    return d;
+}
+
+// arena_reset() frees everything allocated from the arena while keeping its
+// memory for reuse. If the last use needed more than one block, they are
+// replaced by a single block as large as all of them, so a process running
+// the same listing over and over stops calling malloc after the first time.
+void arena_reset(struct arena *a){
+    struct arena_block *b;
+    size_t cap = 0;
+
+    if (a->head == NULL){
+        return;
+    }
+    if (a->head->next == NULL){
+        a->head->used = 0;
+        return;
+    }
+    for (b = a->head; b != NULL; b = b->next){
+        cap += b->cap;
+    }
+    arena_free(a);
+    if ((b = malloc(sizeof(struct arena_block) + cap)) == NULL){
+        return;
+    }
+    b->next = NULL;
+    b->cap = cap;
+    b->used = 0;
+    a->head = b;
+    a->blocks++;
+}
+
+// arena_free() frees the arena's blocks, leaving it empty
+void arena_free(struct arena *a){
+    struct arena_block *b;
+
+    while ((b = a->head) != NULL){
+        a->head = b->next;
+        free(b);
+    }
+}
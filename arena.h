@@ -0,0 +1,33 @@
+#include <stddef.h>
+
+#define ARENA_BLOCK_SZ 4096
+
+// arena_align is the most strictly aligned type handed out by an arena. Every
+// allocation is a whole number of them.
+union arena_align{
+    long double ld;
+    long long ll;
+    void *p;
+};
+
+// arena_block is one chunk of memory an arena hands allocations out of
+struct arena_block{
+    struct arena_block *next;
+    size_t cap;
+    size_t used;
+    union arena_align data[];
+};
+
+// arena holds the results of listing queries. Rows and their strings are
+// carved out of a few large blocks rather than malloc'd one by one, and all of
+// them are freed together. A zeroed arena is empty and ready to use.
+struct arena{
+    struct arena_block *head;
+    long blocks;
+};
+
+void *arena_alloc(struct arena *a, size_t sz);
+void *arena_grow(struct arena *a, void *p, size_t old_sz, size_t new_sz);
+char *arena_strndup(struct arena *a, const char *s, size_t l);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
@@ -0,0 +1,875 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "project.h"
+#include "tasks.h"
+#include "task_utils.h"
+#include "db.h"
+#include "migrate.h"
+#include "days.h"
+#include "report.h"
+
+#define BENCH_DIR "./.bench"
+#define BENCH_PROJ_NAME "bench"
+#define BENCH_DB_PATH "./bench.db"
+#define PROBE_DB_PATH "./probe.db"
+#define MAX_RESULTS 128
+#define BUCKET_STAMPS 100000
+// The report over every project gets a master db of its own listing this
+// many projects, each with a db file of small generated projects
+#define ALL_MDB_PATH "./.allmdb.db"
+#define ALL_PROJECTS 300
+#define ALL_TASKS 20
+#define ALL_STAMPS 400
+
+// bench_config holds the sizes and repetitions of a run, set from the command
+// line
+struct bench_config{
+    int tasks;
+    long stamps;
+    int projects;
+    int iters;
+    char *label;
+    char *out;
+};
+
+// bench_result holds the timings of one benchmark in microseconds, and the
+// mean number of mallocs per run if they were counted
+struct bench_result{
+    char name[32];
+    const char *mode;
+    int iters;
+    double mean;
+    double min;
+    double median;
+    double max;
+    double allocs;
+};
+
+static struct bench_result results[MAX_RESULTS];
+static int num_results = 0;
+
+// malloc_calls counts the malloc() and realloc() calls made by qlock's own
+// code. The bench is linked with --wrap for both, so the calls land in the
+// wrappers below before going on to the real functions. Calls made inside
+// SQLite are not counted.
+static long malloc_calls = 0;
+
+void *__real_malloc(size_t sz);
+void *__real_realloc(void *p, size_t sz);
+
+void *__wrap_malloc(size_t sz){
+    malloc_calls++;
+    return __real_malloc(sz);
+}
+
+void *__wrap_realloc(void *p, size_t sz){
+    malloc_calls++;
+    return __real_realloc(p, sz);
+}
+
+// now_sec() returns a monotonic time in seconds
+double now_sec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// exec_sql() runs a statement which returns no rows
+int exec_sql(sqlite3 *db, char *sql){
+    int e;
+
+    if ((e = sqlite3_exec(db, sql, NULL, NULL, NULL)) != SQLITE_OK){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+    }
+    return e;
+}
+
+// cmp_double() orders doubles for qsort()
+int cmp_double(const void *a, const void *b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+// record() summarises the timings of n runs of a benchmark into the results
+void record(const char *name, const char *mode, double *t, int n){
+    struct bench_result *r;
+    double sum = 0;
+
+    if (num_results == MAX_RESULTS || n == 0){
+        return;
+    }
+    r = &results[num_results++];
+    qsort(t, n, sizeof(double), cmp_double);
+    for (int i = 0; i < n; i++){
+        sum += t[i];
+    }
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->mode = mode;
+    r->iters = n;
+    r->mean = sum/n*1e6;
+    r->min = t[0]*1e6;
+    r->median = (n%2 ? t[n/2] : (t[n/2-1] + t[n/2])/2)*1e6;
+    r->max = t[n-1]*1e6;
+    r->allocs = -1;
+    fprintf(stderr, "%-24s %-6s %6d runs %12.1f us median\n", name, mode, n, r->median);
+}
+
+// generate_project() replaces the contents of a project with num_tasks tasks
+// sharing about num_stamps timestamps, spread over the last year in sessions
+// of up to two hours. Odd numbered tasks are left open by giving them one
+// stamp more than the even ones, which get an even number, so their last
+// session has no end.
+int generate_project(sqlite3 *db, int num_tasks, long num_stamps){
+    char *insert_task = "INSERT INTO task_info (id, name, description) VALUES (?1, ?2, 'generated');";
+    char *insert_ts = "INSERT INTO sessions (task_id, start, end) VALUES (?1, ?2, ?3);";
+    sqlite3_stmt *task_stmt, *ts_stmt;
+    time_t start = time(NULL) - 365*24*3600;
+    long per = num_stamps/num_tasks;
+    char name[32];
+    time_t ts;
+    time_t since = 0;
+    long n;
+    int e = SQLITE_DONE;
+
+    per -= per%2;
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "DELETE FROM task_info;");
+    exec_sql(db, "DELETE FROM sessions;");
+    sqlite3_prepare_v2(db, insert_task, -1, &task_stmt, NULL);
+    sqlite3_prepare_v2(db, insert_ts, -1, &ts_stmt, NULL);
+    srand(1);
+    for (int id = 1; id <= num_tasks && e == SQLITE_DONE; id++){
+        snprintf(name, sizeof(name), "task %d", id);
+        sqlite3_bind_int(task_stmt, 1, id);
+        sqlite3_bind_text(task_stmt, 2, name, -1, SQLITE_TRANSIENT);
+        e = sqlite3_step(task_stmt);
+        sqlite3_reset(task_stmt);
+        n = per + (id%2);
+        ts = start + rand()%3600;
+        for (long j = 0; j < n && e == SQLITE_DONE; j++){
+            // Sessions last up to two hours with up to a day between them,
+            // so the open stamp of odd tasks still lands in the past
+            ts += (j%2 ? 60 + rand()%7200 : 60 + rand()%(365*24*3600/(n+1)));
+            if (j%2 == 0){
+                since = ts;
+                if (j < n-1){
+                    continue;
+                }
+            }
+            sqlite3_bind_int(ts_stmt, 1, id);
+            sqlite3_bind_int64(ts_stmt, 2, since);
+            if (j%2){
+                sqlite3_bind_int64(ts_stmt, 3, ts);
+            } else{
+                sqlite3_bind_null(ts_stmt, 3);
+            }
+            e = sqlite3_step(ts_stmt);
+            sqlite3_reset(ts_stmt);
+        }
+    }
+    sqlite3_finalize(task_stmt);
+    sqlite3_finalize(ts_stmt);
+    if (e != SQLITE_DONE){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+        exec_sql(db, "ROLLBACK;");
+        return e;
+    }
+    if ((e = exec_sql(db, "COMMIT;")) != SQLITE_OK){
+        return e;
+    }
+    return rebuild_rollups(db);
+}
+
+// add_projects() adds n inactive projects to the master db so listing
+// projects has something to list. Their db files are never made.
+int add_projects(sqlite3 *mdb, int n){
+    sqlite3_stmt *stmt;
+    char name[32];
+
+    exec_sql(mdb, "BEGIN;");
+    sqlite3_prepare_v2(mdb, "INSERT INTO proj_info (name, active) VALUES (?1, 0);", -1, &stmt, NULL);
+    for (int i = 0; i < n; i++){
+        snprintf(name, sizeof(name), "listed%d", i);
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    return exec_sql(mdb, "COMMIT;");
+}
+
+// feed_stdin() makes the formatted text stdin, for commands which prompt
+void feed_stdin(const char *fmt, int i){
+    FILE *f = tmpfile();
+
+    fprintf(f, fmt, i);
+    fflush(f);
+    rewind(f);
+    dup2(fileno(f), STDIN_FILENO);
+    fclose(f);
+    clearerr(stdin);
+}
+
+// cmd_bench is a command path to time. undo is run untimed after every run of
+// argv to put the project back, and input is fed to stdin before each run
+// with a number that is new each time filled in. Heavy commands get a tenth
+// of the runs.
+struct cmd_bench{
+    const char *name;
+    char *argv[5];
+    char *undo[5];
+    const char *input;
+    int heavy;
+};
+
+// run_command() runs a command the way qlock would. Cold runs start from a
+// fresh context like a new process, warm runs reuse ctx like qlockd does.
+double run_command(struct qlock_ctx *ctx, char **argv, int warm){
+    struct qlock_ctx fresh = {NULL, NULL, NULL, {NULL, 0}};
+    int argc = 0;
+    double t0;
+
+    while (argv[argc] != NULL){
+        argc++;
+    }
+    t0 = now_sec();
+    if (warm){
+        ctx_refresh(ctx);
+        handle_input(ctx, argc, argv);
+    } else{
+        handle_input(&fresh, argc, argv);
+        close_ctx(&fresh);
+    }
+    return now_sec() - t0;
+}
+
+// bench_commands() times every command path, both cold and warm
+void bench_commands(struct bench_config *cfg){
+    char closed_id[16], open_id[16], closed_name[32];
+    struct qlock_ctx ctx = {NULL, NULL, NULL, {NULL, 0}};
+    double *t = malloc(cfg->iters*sizeof(double));
+    const char *modes[] = {"cold", "warm"};
+    int n;
+
+    // Even ids are closed and odd ones open, see generate_project()
+    snprintf(closed_id, sizeof(closed_id), "%d", cfg->tasks/2 - (cfg->tasks/2)%2);
+    snprintf(open_id, sizeof(open_id), "%d", cfg->tasks/2 - (cfg->tasks/2)%2 + 1);
+    snprintf(closed_name, sizeof(closed_name), "task %s", closed_id);
+    struct cmd_bench cmds[] = {
+        {"in", {"qlock", "in", closed_id, NULL}, {"qlock", "out", closed_id, NULL}, NULL, 0},
+        {"out", {"qlock", "out", open_id, NULL}, {"qlock", "in", open_id, NULL}, NULL, 0},
+        {"swap", {"qlock", "swap", open_id, closed_id, NULL}, {"qlock", "swap", closed_id, open_id, NULL}, NULL, 0},
+        {"in by name", {"qlock", "in", closed_name, NULL}, {"qlock", "out", closed_id, NULL}, NULL, 0},
+        {"search", {"qlock", "search", "task", closed_id, NULL}, {NULL}, NULL, 0},
+        {"active", {"qlock", "active", NULL}, {NULL}, NULL, 1},
+        {"active --all", {"qlock", "active", "--all", NULL}, {NULL}, NULL, 0},
+        {"list t", {"qlock", "list", "t", NULL}, {NULL}, NULL, 1},
+        {"list p", {"qlock", "list", "p", NULL}, {NULL}, NULL, 0},
+        {"elapsed", {"qlock", "elapsed", closed_id, NULL}, {NULL}, NULL, 0},
+        {"switch", {"qlock", "switch", "temp", NULL}, {"qlock", "switch", BENCH_PROJ_NAME, NULL}, NULL, 0},
+        {"new t", {"qlock", "new", "t", NULL}, {NULL}, "bench task %d\nbench description\n", 0},
+        {"new p", {"qlock", "new", "p", NULL}, {"qlock", "switch", BENCH_PROJ_NAME, NULL}, "made%d\n", 0},
+    };
+    int num_cmds = sizeof(cmds)/sizeof(cmds[0]);
+    int fed = 0;
+
+    for (int m = 0; m < 2; m++){
+        for (int c = 0; c < num_cmds; c++){
+            n = cmds[c].heavy ? (cfg->iters+9)/10 : cfg->iters;
+            for (int i = 0; i < n; i++){
+                if (cmds[c].input != NULL){
+                    feed_stdin(cmds[c].input, fed++);
+                }
+                t[i] = run_command(&ctx, cmds[c].argv, m);
+                if (cmds[c].undo[0] != NULL){
+                    run_command(&ctx, cmds[c].undo, m);
+                }
+            }
+            record(cmds[c].name, modes[m], t, n);
+        }
+    }
+    close_ctx(&ctx);
+    free(t);
+}
+
+// noop_day() is a breakdown callback which does nothing with the day
+int noop_day(struct day_elapsed *d, void *ctx){
+    return 0;
+}
+
+// noop_task() is a listing callback which does nothing with the task
+int noop_task(struct task_row *t, void *ctx){
+    return 0;
+}
+
+// bench_task_utils() times the functions of task_utils.c on the generated
+// project. Functions which write are rolled back after each run.
+void bench_task_utils(sqlite3 *db, struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(cfg->iters*sizeof(double));
+    int closed = cfg->tasks/2 - (cfg->tasks/2)%2;
+    FILE *devnull = fopen("/dev/null", "w");
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    struct open_total *ot;
+    time_t now = time(NULL);
+    time_t last;
+    char closed_name[32];
+    int found;
+    double t0;
+
+    snprintf(closed_name, sizeof(closed_name), "task %d", closed);
+
+#define TIME_RUNS(name, runs, setup, call, teardown) \
+    for (int i = 0; i < (runs); i++){ \
+        setup; \
+        t0 = now_sec(); \
+        call; \
+        t[i] = now_sec() - t0; \
+        teardown; \
+    } \
+    record(name, "lib", t, (runs));
+
+    TIME_RUNS("get_num_timestamps", cfg->iters, , get_num_timestamps(db, closed), );
+    TIME_RUNS("task_is_open", cfg->iters, , task_is_open(db, closed), );
+    TIME_RUNS("task_exists", cfg->iters, , task_exists(db, closed), );
+    TIME_RUNS("get_max_id", cfg->iters, , get_max_id(db), );
+    TIME_RUNS("get_open_session", cfg->iters, , get_open_session(db, closed, &last), );
+    TIME_RUNS("search_tasks", cfg->iters, , search_tasks(db, closed_name, 20, noop_task, NULL), );
+    TIME_RUNS("find_task", cfg->iters, , find_task(db, closed_name, &found), );
+    TIME_RUNS("day_key", cfg->iters, , day_key(now + i), );
+    TIME_RUNS("get_open_tasks", heavy, , get_open_tasks(db, &a, &o), arena_reset(&a));
+    TIME_RUNS("get_all_tasks", heavy, , get_all_tasks(db, &a, &o), arena_reset(&a));
+    TIME_RUNS("print_all_tasks", heavy, , print_all_tasks(db, devnull), );
+    TIME_RUNS("each_task", heavy, , each_task(db, TASKS_ALL, noop_task, NULL), );
+    TIME_RUNS("get_open_totals", heavy, , get_open_totals(db, &a, &ot), arena_reset(&a));
+    TIME_RUNS("get_data_version", cfg->iters, , get_data_version(db), );
+    TIME_RUNS("get_elapsed_breakdown", cfg->iters, , get_elapsed_breakdown(db, closed, noop_day, NULL), );
+    TIME_RUNS("add_rollup", cfg->iters, begin_savepoint(db),
+              add_rollup(db, closed, day_key(now), 60), rollback_savepoint(db));
+    TIME_RUNS("credit_session", cfg->iters, begin_savepoint(db),
+              credit_session(db, closed, now - 3600, now), rollback_savepoint(db));
+    TIME_RUNS("rebuild_rollups", heavy, begin_savepoint(db),
+              rebuild_rollups(db), rollback_savepoint(db));
+
+#undef TIME_RUNS
+    arena_free(&a);
+    fclose(devnull);
+    free(t);
+}
+
+// list_tasks_malloc() lists every task the way get_all_tasks() used to, with a
+// realloc'd array and a malloc'd copy of each string. It is kept here as the
+// baseline to compare the arena against.
+int list_tasks_malloc(sqlite3 *db, struct task_row **o){
+    struct cached_stmt *cs;
+    struct task_row *rows = NULL;
+    int n = 0;
+    int cap = 0;
+
+    if ((cs = get_stmt(db, STMT_ALL_TASKS)) == NULL){
+        return -1;
+    }
+    while (sqlite3_step(cs->stmt) == SQLITE_ROW){
+        if (n == cap){
+            cap = (cap == 0) ? 8 : cap*2;
+            rows = realloc(rows, cap*sizeof(struct task_row));
+        }
+        rows[n].id = sqlite3_column_int(cs->stmt, 0);
+        rows[n].name = malloc(sqlite3_column_bytes(cs->stmt, 1) + 1);
+        strcpy(rows[n].name, (const char*)sqlite3_column_text(cs->stmt, 1));
+        rows[n].desc = malloc(sqlite3_column_bytes(cs->stmt, 2) + 1);
+        strcpy(rows[n].desc, (const char*)sqlite3_column_text(cs->stmt, 2));
+        n++;
+    }
+    sqlite3_reset(cs->stmt);
+    *o = rows;
+    return n;
+}
+
+// bench_list_allocs() counts the mallocs each listing makes per call, along
+// with its time. Cold runs use a new arena each time, as a fresh qlock process
+// does, and warm runs reset one arena between calls, as qlockd does, after
+// one call to size it.
+void bench_list_allocs(sqlite3 *db, sqlite3 *mdb, struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(heavy*sizeof(double));
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    char **names;
+    long before;
+    double t0;
+    int n = 0;
+
+#define COUNT_RUNS(name, mode, call, teardown) \
+    before = malloc_calls; \
+    for (int i = 0; i < heavy; i++){ \
+        t0 = now_sec(); \
+        call; \
+        t[i] = now_sec() - t0; \
+        teardown; \
+    } \
+    record(name, mode, t, heavy); \
+    results[num_results-1].allocs = (double)(malloc_calls - before)/heavy; \
+    fprintf(stderr, "%-24s %-6s %6.1f mallocs per call\n", name, mode, results[num_results-1].allocs);
+
+    COUNT_RUNS("list get_all_tasks", "cold", get_all_tasks(db, &a, &o), arena_free(&a));
+    get_all_tasks(db, &a, &o);
+    arena_reset(&a);
+    COUNT_RUNS("list get_all_tasks", "warm", get_all_tasks(db, &a, &o), arena_reset(&a));
+    COUNT_RUNS("list get_all_tasks", "base", n = list_tasks_malloc(db, &o),
+               for (int j = 0; j < n; j++){ free(o[j].name); free(o[j].desc); } free(o));
+    COUNT_RUNS("list each_task", "lib", each_task(db, TASKS_ALL, noop_task, NULL), );
+    arena_free(&a);
+    COUNT_RUNS("list get_open_tasks", "cold", get_open_tasks(db, &a, &o), arena_free(&a));
+    get_open_tasks(db, &a, &o);
+    arena_reset(&a);
+    COUNT_RUNS("list get_open_tasks", "warm", get_open_tasks(db, &a, &o), arena_reset(&a));
+    arena_free(&a);
+    COUNT_RUNS("list get_all_projects", "cold", get_all_projects(mdb, &a, &names), arena_free(&a));
+    get_all_projects(mdb, &a, &names);
+    arena_reset(&a);
+    COUNT_RUNS("list get_all_projects", "warm", get_all_projects(mdb, &a, &names), arena_reset(&a));
+    arena_free(&a);
+
+#undef COUNT_RUNS
+    free(t);
+}
+
+// probe_open_tasks() counts open tasks the way get_open_tasks() used to, by
+// checking every id up to the max id one at a time. It is kept here as the
+// baseline to compare against.
+int probe_open_tasks(sqlite3 *db){
+    int n = 0;
+
+    for (int id = 0; id <= get_max_id(db); id++){
+        if (task_is_open(db, id)){
+            n++;
+        }
+    }
+    return n;
+}
+
+// bench_open_tasks() times get_open_tasks() against the per-id probe on a
+// project of its own, small enough for the probe to finish
+void bench_open_tasks(struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(heavy*sizeof(double));
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    sqlite3 *db;
+    double t0;
+    int n = 0;
+    int m = 0;
+
+    if (open_db(PROBE_DB_PATH, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != SQLITE_OK){
+        free(t);
+        return;
+    }
+    migrate_project_db(db);
+    generate_project(db, 2000, 16000);
+    for (int i = 0; i < heavy; i++){
+        t0 = now_sec();
+        n = get_open_tasks(db, &a, &o);
+        t[i] = now_sec() - t0;
+        arena_reset(&a);
+    }
+    arena_free(&a);
+    record("open_tasks_grouped", "base", t, heavy);
+    for (int i = 0; i < heavy; i++){
+        t0 = now_sec();
+        m = probe_open_tasks(db);
+        t[i] = now_sec() - t0;
+    }
+    record("open_tasks_probe", "base", t, heavy);
+    if (n != m){
+        fprintf(stderr, "Open task counts differ: %d != %d\n", n, m);
+    }
+    close_db(db);
+    free(t);
+}
+
+// bench_day_buckets() times putting BUCKET_STAMPS times from the last year in
+// their local day, by a localtime() call each (day_key()) as the baseline and
+// by a day_calendar built fresh for each run
+void bench_day_buckets(struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(heavy*sizeof(double));
+    time_t *stamps = malloc(BUCKET_STAMPS*sizeof(time_t));
+    time_t start = time(NULL) - 365*24*3600;
+    struct day_calendar cal = {NULL, NULL, 0, 0};
+    long long base = 0;
+    long long sum = 0;
+    double t0;
+    int k;
+
+    srand(1);
+    for (int i = 0; i < BUCKET_STAMPS; i++){
+        stamps[i] = start + ((long long)rand()*RAND_MAX + rand()) % (365*24*3600);
+    }
+    for (int r = 0; r < heavy; r++){
+        base = 0;
+        t0 = now_sec();
+        for (int i = 0; i < BUCKET_STAMPS; i++){
+            base += day_key(stamps[i]);
+        }
+        t[r] = now_sec() - t0;
+    }
+    record("day_buckets_localtime", "base", t, heavy);
+    for (int r = 0; r < heavy; r++){
+        sum = 0;
+        t0 = now_sec();
+        for (int i = 0; i < BUCKET_STAMPS; i++){
+            k = calendar_find(&cal, stamps[i]);
+            sum += cal.keys[k];
+        }
+        t[r] = now_sec() - t0;
+        calendar_free(&cal);
+    }
+    record("day_buckets_calendar", "base", t, heavy);
+    if (sum != base){
+        fprintf(stderr, "Day buckets differ: %lld != %lld\n", sum, base);
+    }
+    free(stamps);
+    free(t);
+}
+
+// noop_day_sum() is a breakdown callback which only adds up the days
+int noop_day_sum(struct day_elapsed *d, void *ctx){
+    *(long long*)ctx += d->seconds;
+    return 0;
+}
+
+// bench_report() times a report of the whole generated project with 1, 2, 4
+// and 8 workers, against breaking down every task one after the other on a
+// single connection the way a loop over 'qlock elapsed' would
+void bench_report(sqlite3 *db, struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(heavy*sizeof(double));
+    struct project_report r;
+    char name[32];
+    long long base = 0;
+    long long sum = 0;
+    double t0;
+
+    for (int i = 0; i < heavy; i++){
+        base = 0;
+        t0 = now_sec();
+        for (int id = 1; id <= cfg->tasks; id++){
+            get_elapsed_breakdown(db, id, noop_day_sum, &base);
+        }
+        t[i] = now_sec() - t0;
+    }
+    record("report_serial", "base", t, heavy);
+    for (int w = 1; w <= 8; w *= 2){
+        for (int i = 0; i < heavy; i++){
+            t0 = now_sec();
+            report_project(BENCH_DB_PATH, w, &r);
+            t[i] = now_sec() - t0;
+            sum = 0;
+            for (int k = 0; k < r.num_tasks; k++){
+                sum += r.tasks[k].total;
+            }
+            report_free(&r);
+        }
+        snprintf(name, sizeof(name), "report_%d_workers", w);
+        record(name, "lib", t, heavy);
+    }
+    // Open sessions count up to the time they are read, so only finished
+    // time is expected to match exactly
+    if (sum < base - (long long)cfg->tasks*600 || sum > base + (long long)cfg->tasks*600){
+        fprintf(stderr, "Report totals differ: %lld != %lld\n", sum, base);
+    }
+    free(t);
+}
+
+// sum_report_one() is an each_project() callback which reports on a single
+// project with one worker, adding its total to ctx
+int sum_report_one(char *name, void *ctx){
+    struct project_report r;
+    char *path = project_db_path(name);
+
+    if (report_project(path, 1, &r) >= 0){
+        for (int i = 0; i < r.num_tasks; i++){
+            *(long long*)ctx += r.tasks[i].total;
+        }
+        report_free(&r);
+    }
+    free(path);
+    return 0;
+}
+
+// generate_all_projects() builds the master db at ALL_MDB_PATH listing
+// ALL_PROJECTS generated projects. Returns NULL on error.
+sqlite3 *generate_all_projects(void){
+    sqlite3 *mdb = NULL;
+    sqlite3 *db;
+    char name[32];
+
+    if (create_master_db(&mdb, ALL_MDB_PATH) != SQLITE_OK){
+        return NULL;
+    }
+    fprintf(stderr, "Generating %d projects...\n", ALL_PROJECTS);
+    for (int p = 0; p < ALL_PROJECTS; p++){
+        snprintf(name, sizeof(name), "all%d", p);
+        create_project(NULL, mdb, name);
+        snprintf(name, sizeof(name), "all%d.db", p);
+        if (open_db(name, &db, SQLITE_OPEN_READWRITE) == SQLITE_OK){
+            generate_project(db, ALL_TASKS, ALL_STAMPS);
+            close_db(db);
+        }
+    }
+    return mdb;
+}
+
+// bench_report_all() times a report over the generated projects with 1, 2, 4
+// and 8 workers, against reporting on each project in turn as a loop over
+// 'qlock report' would
+void bench_report_all(sqlite3 *mdb, struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(heavy*sizeof(double));
+    struct all_report r;
+    char name[32];
+    long long base = 0;
+    double t0;
+
+    for (int i = 0; i < heavy; i++){
+        base = 0;
+        t0 = now_sec();
+        each_project(mdb, sum_report_one, &base);
+        t[i] = now_sec() - t0;
+    }
+    record("report_all_serial", "base", t, heavy);
+    for (int w = 1; w <= 8; w *= 2){
+        for (int i = 0; i < heavy; i++){
+            t0 = now_sec();
+            report_all(mdb, w, &r);
+            t[i] = now_sec() - t0;
+            all_report_free(&r);
+        }
+        snprintf(name, sizeof(name), "report_all_%d_workers", w);
+        record(name, "lib", t, heavy);
+    }
+    free(t);
+}
+
+// count_open_one() is an each_project() callback which counts the open tasks
+// of a project from its own db, adding them to ctx
+int count_open_one(char *name, void *ctx){
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    char *path = project_db_path(name);
+    sqlite3 *db;
+    int n;
+
+    if (open_db(path, &db, SQLITE_OPEN_READONLY) == SQLITE_OK){
+        if ((n = get_open_tasks(db, &a, &o)) > 0){
+            *(int*)ctx += n;
+        }
+        close_db(db);
+    }
+    arena_free(&a);
+    free(path);
+    return 0;
+}
+
+// count_indexed() is an each_open_session() callback which counts sessions
+int count_indexed(struct open_session *s, void *ctx){
+    (*(int*)ctx)++;
+    return 0;
+}
+
+// bench_active_all() times listing what is open in every generated project
+// from the master db's index, against opening every project as 'qlock active'
+// would. The projects were generated straight into their files, so the index
+// is reconciled first, which is timed too.
+void bench_active_all(sqlite3 *mdb, struct bench_config *cfg){
+    int heavy = (cfg->iters+9)/10;
+    double *t = malloc(cfg->iters*sizeof(double));
+    double t0;
+    int n = 0;
+    int m = 0;
+
+    for (int i = 0; i < heavy; i++){
+        t0 = now_sec();
+        reconcile_open_sessions(mdb);
+        t[i] = now_sec() - t0;
+    }
+    record("reconcile_open", "lib", t, heavy);
+    for (int i = 0; i < heavy; i++){
+        n = 0;
+        t0 = now_sec();
+        each_project(mdb, count_open_one, &n);
+        t[i] = now_sec() - t0;
+    }
+    record("active_all_scan", "base", t, heavy);
+    for (int i = 0; i < cfg->iters; i++){
+        m = 0;
+        t0 = now_sec();
+        each_open_session(mdb, count_indexed, &m);
+        t[i] = now_sec() - t0;
+    }
+    record("active_all_index", "lib", t, cfg->iters);
+    if (n != m){
+        fprintf(stderr, "Open session counts differ: %d != %d\n", n, m);
+    }
+    free(t);
+}
+
+// write_json() writes the configuration and results of the run to out
+void write_json(FILE *out, struct bench_config *cfg, double gen_sec){
+    fprintf(out, "{\n  \"label\": \"%s\",\n", cfg->label);
+    fprintf(out, "  \"sqlite\": \"%s\",\n", sqlite3_libversion());
+    fprintf(out, "  \"config\": {\"tasks\": %d, \"stamps\": %ld, \"projects\": %d, \"iterations\": %d},\n",
+            cfg->tasks, cfg->stamps, cfg->projects, cfg->iters);
+    fprintf(out, "  \"generate_seconds\": %.3f,\n", gen_sec);
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < num_results; i++){
+        struct bench_result *r = &results[i];
+
+        fprintf(out, "    {\"name\": \"%s\", \"mode\": \"%s\", \"iterations\": %d, "
+                "\"mean_us\": %.2f, \"min_us\": %.2f, \"median_us\": %.2f, \"max_us\": %.2f",
+                r->name, r->mode, r->iters, r->mean, r->min, r->median, r->max);
+        if (r->allocs >= 0){
+            fprintf(out, ", \"allocs_per_call\": %.1f", r->allocs);
+        }
+        fprintf(out, "}%s\n", i+1 < num_results ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// clear_bench_dir() removes every file in the bench directory, which is the
+// working directory by the time this is called
+void clear_bench_dir(void){
+    struct dirent *ent;
+    DIR *dir;
+
+    if ((dir = opendir(".")) == NULL){
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL){
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0){
+            remove(ent->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// usage() prints the options of the benchmarks
+int usage(char *prog){
+    fprintf(stderr, "Usage: %s [--tasks N] [--stamps N] [--projects N] [--iters N] "
+            "[--label TEXT] [--out FILE]\n", prog);
+    return 1;
+}
+
+int main(int argc, char **argv){
+    struct bench_config cfg = {10000, 1000000, 100, 50, "", NULL};
+    struct stat st = {0};
+    sqlite3 *db = NULL;
+    sqlite3 *mdb = NULL;
+    sqlite3 *amdb;
+    FILE *out;
+    double t0, gen_sec;
+
+    for (int i = 1; i < argc; i++){
+        if (i+1 == argc){
+            return usage(argv[0]);
+        } else if (strcmp(argv[i], "--tasks") == 0){
+            cfg.tasks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stamps") == 0){
+            cfg.stamps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--projects") == 0){
+            cfg.projects = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--iters") == 0){
+            cfg.iters = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--label") == 0){
+            cfg.label = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0){
+            cfg.out = argv[++i];
+        } else{
+            return usage(argv[0]);
+        }
+    }
+    if (cfg.tasks < 4 || cfg.stamps < 2*cfg.tasks || cfg.iters < 1 || cfg.projects < 0){
+        fprintf(stderr, "Need at least 4 tasks, 2 stamps per task and 1 iteration.\n");
+        return 1;
+    }
+
+    // The results go to the real stdout, or --out, while what the commands
+    // print is thrown away
+    if (cfg.out != NULL){
+        out = fopen(cfg.out, "w");
+    } else{
+        out = fdopen(dup(STDOUT_FILENO), "w");
+    }
+    if (out == NULL){
+        fprintf(stderr, "Could not open the output for the results.\n");
+        return 1;
+    }
+    freopen("/dev/null", "w", stdout);
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    // Everything runs in the bench directory so the commands find the bench
+    // master db and active project at their usual paths
+    if (stat(BENCH_DIR, &st) == -1){
+        mkdir(BENCH_DIR, 0700);
+    }
+    if (chdir(BENCH_DIR) != 0){
+        fprintf(stderr, "Could not enter %s.\n", BENCH_DIR);
+        return 1;
+    }
+    clear_bench_dir();
+
+    if (open_master_db(&mdb) != SQLITE_OK || create_project(NULL, mdb, BENCH_PROJ_NAME) != 0){
+        fprintf(stderr, "Could not create the bench project.\n");
+        return 1;
+    }
+    write_active_cache(ACTIVE_CACHE_PATH, BENCH_PROJ_NAME, MDB_PATH);
+    add_projects(mdb, cfg.projects);
+    if (open_db(BENCH_DB_PATH, &db, SQLITE_OPEN_READWRITE) != SQLITE_OK){
+        fprintf(stderr, "Could not open bench project at %s.\n", BENCH_DB_PATH);
+        return 1;
+    }
+    fprintf(stderr, "Generating %d tasks with %ld stamps...\n", cfg.tasks, cfg.stamps);
+    t0 = now_sec();
+    if (generate_project(db, cfg.tasks, cfg.stamps) != SQLITE_OK){
+        fprintf(stderr, "Could not generate the bench project.\n");
+        return 1;
+    }
+    gen_sec = now_sec() - t0;
+
+    bench_commands(&cfg);
+    bench_task_utils(db, &cfg);
+    bench_list_allocs(db, mdb, &cfg);
+    bench_open_tasks(&cfg);
+    bench_day_buckets(&cfg);
+    bench_report(db, &cfg);
+    if ((amdb = generate_all_projects()) != NULL){
+        bench_report_all(amdb, &cfg);
+        bench_active_all(amdb, &cfg);
+        close_db(amdb);
+    }
+    write_json(out, &cfg, gen_sec);
+    fclose(out);
+
+    close_db(db);
+    close_db(mdb);
+    clear_bench_dir();
+    chdir("..");
+    rmdir(BENCH_DIR);
+    return 0;
+}
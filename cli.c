@@ -0,0 +1,957 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "project.h"
+#include "tasks.h"
+#include "task_utils.h"
+#include "db.h"
+#include "migrate.h"
+#include "import.h"
+#include "export.h"
+#include "trace.h"
+#include "report.h"
+
+#define MAX_PROJ_NAME_SZ 32
+#define MAX_TASK_NAME_SZ 64
+#define MAX_TASK_DESC_SZ 256
+#define EXPORT_BUF_SZ (1 << 16)
+#define SEARCH_LIMIT 20
+#define WATCH_INTERVAL_SEC 1
+
+// print_hms() prints a number of seconds as hh:mm:ss
+void print_hms(int elapsed){
+    int hr, min, sec;
+
+    hr = elapsed/3600;
+    min = (elapsed-hr*3600)/60;
+    sec = elapsed-(hr*3600+min*60);
+    printf("%02d:%02d:%02d", hr, min, sec);
+}
+
+// print_day() prints a single day of an elapsed breakdown and adds it to the
+// running total in ctx, if it is given one
+int print_day(struct day_elapsed *d, void *ctx){
+    if (ctx != NULL){
+        *(int*)ctx += d->seconds;
+    }
+    printf("%d-%d-%d: ", d->year, d->mon, d->mday);
+    print_hms(d->seconds);
+    printf("\n");
+    return 0;
+}
+
+// open_master_db() opens the master db, building it if it does not exist yet
+// and upgrading it if it is from an older version
+int open_master_db(sqlite3 **mdb){
+    int e;
+
+    if (access(MDB_PATH, F_OK) == -1){
+        printf("Building master db at %s\n", MDB_PATH);
+        return create_master_db(mdb, MDB_PATH);
+    }
+    if ((e = open_db(MDB_PATH, mdb, SQLITE_OPEN_READWRITE)) != SQLITE_OK){
+        fprintf(stderr, "Can't open database: %s\n", sqlite3_errstr(e));
+        return e;
+    }
+    if ((e = migrate_master_db(*mdb)) != SQLITE_OK){
+        close_db(*mdb);
+        *mdb = NULL;
+        return e;
+    }
+    return SQLITE_OK;
+}
+
+// ctx_mdb() returns the master db of the context, opening it on first use.
+// Returns NULL if it could not be opened.
+sqlite3 *ctx_mdb(struct qlock_ctx *ctx){
+    if (ctx->mdb == NULL && open_master_db(&ctx->mdb) != SQLITE_OK){
+        fprintf(stderr, "Could not open the master db at %s.\n", MDB_PATH);
+        return NULL;
+    }
+    return ctx->mdb;
+}
+
+// ctx_set_project() makes name the active project of the context, closing the
+// db of the previous one and recording the name in the active project cache
+void ctx_set_project(struct qlock_ctx *ctx, char *name){
+    if (ctx->db != NULL){
+        close_db(ctx->db);
+        ctx->db = NULL;
+    }
+    free(ctx->name);
+    ctx->name = malloc(strlen(name)+1);
+    strcpy(ctx->name, name);
+    write_active_cache(ACTIVE_CACHE_PATH, name, MDB_PATH);
+}
+
+// resolve_project() looks the active project up in the master db and
+// refreshes the active project cache with it
+static int resolve_project(struct qlock_ctx *ctx){
+    sqlite3 *mdb;
+    char *name;
+
+    if ((mdb = ctx_mdb(ctx)) == NULL){
+        return -1;
+    }
+    if ((name = get_active_project_name(mdb)) == NULL){
+        fprintf(stderr, "There is no active project.\n");
+        return -1;
+    }
+    ctx_set_project(ctx, name);
+    free(name);
+    return 0;
+}
+
+// ctx_project() returns the name of the active project. The name is read from
+// the active project cache when there is one, so finding it usually needs no
+// query. Returns NULL if there is no active project.
+char *ctx_project(struct qlock_ctx *ctx){
+    if (ctx->name == NULL && (ctx->name = read_active_cache(ACTIVE_CACHE_PATH, MDB_PATH)) == NULL){
+        if (resolve_project(ctx) != 0){
+            return NULL;
+        }
+    }
+    return ctx->name;
+}
+
+// open_project() opens and upgrades the db of the context's project, naming
+// the master db whose index of open sessions its clock events keep. The db
+// file is only created if create is set.
+static int open_project(struct qlock_ctx *ctx, int create){
+    int flags = SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+    char *dbpath = project_db_path(ctx->name);
+    int e;
+
+    if ((e = open_db(dbpath, &ctx->db, flags)) == SQLITE_OK){
+        if ((e = migrate_project_db(ctx->db)) != SQLITE_OK){
+            fprintf(stderr, "Could not upgrade project %s at path %s.\n", ctx->name, dbpath);
+        } else if (set_index_project(ctx->db, MDB_PATH, ctx->name) != 0){
+            e = SQLITE_NOMEM;
+        }
+    } else if (create){
+        fprintf(stderr, "Could not open project %s at path %s.\n", ctx->name, dbpath);
+    }
+    if (e != SQLITE_OK && ctx->db != NULL){
+        close_db(ctx->db);
+        ctx->db = NULL;
+    }
+    free(dbpath);
+    return e;
+}
+
+// ctx_db() returns the db of the active project, opening it on first use.
+// Returns NULL if it could not be opened.
+sqlite3 *ctx_db(struct qlock_ctx *ctx){
+    if (ctx->db != NULL){
+        return ctx->db;
+    }
+    if (ctx_project(ctx) == NULL){
+        return NULL;
+    }
+    // A cached name is only trusted if its db is there, otherwise the
+    // master db has the final say
+    if (open_project(ctx, 0) != SQLITE_OK){
+        if (resolve_project(ctx) != 0 || open_project(ctx, 1) != SQLITE_OK){
+            return NULL;
+        }
+    }
+    return ctx->db;
+}
+
+// ctx_refresh() drops the project of the context if another process has
+// switched the active project since it was resolved. Once the master db has
+// been written the cache no longer vouches for the name, so it is checked
+// against the master db and cached again rather than dropped.
+void ctx_refresh(struct qlock_ctx *ctx){
+    char *name = read_active_cache(ACTIVE_CACHE_PATH, MDB_PATH);
+
+    if (ctx->name != NULL && name == NULL && ctx_mdb(ctx) != NULL
+        && (name = get_active_project_name(ctx->mdb)) != NULL && strcmp(name, ctx->name) == 0){
+        write_active_cache(ACTIVE_CACHE_PATH, name, MDB_PATH);
+    }
+    if (ctx->name != NULL && (name == NULL || strcmp(name, ctx->name) != 0)){
+        if (ctx->db != NULL){
+            close_db(ctx->db);
+            ctx->db = NULL;
+        }
+        free(ctx->name);
+        ctx->name = NULL;
+    }
+    free(name);
+}
+
+// close_ctx() closes every connection the context opened and frees its arena
+void close_ctx(struct qlock_ctx *ctx){
+    if (ctx->db != NULL){
+        close_db(ctx->db);
+    }
+    if (ctx->mdb != NULL){
+        close_db(ctx->mdb);
+    }
+    free(ctx->name);
+    arena_free(&ctx->arena);
+    ctx->db = NULL;
+    ctx->mdb = NULL;
+    ctx->name = NULL;
+}
+
+// cmd_export() processes 'qlock export [--project P|--all] [--format F]'.
+// The active project is exported if no project is given.
+static int cmd_export(struct qlock_ctx *ctx, int argc, char **argv){
+    EXPORT_FORMAT format = EXPORT_CSV;
+    sqlite3 *db = NULL;
+    FILE *out;
+    char *project = NULL;
+    char *dbpath;
+    int all = 0;
+    int n;
+
+    for (int i = 2; i < argc; i++){
+        if (strcmp(argv[i], "--all") == 0){
+            all = 1;
+        } else if ((strcmp(argv[i], "--project") == 0) && (i+1 < argc)){
+            project = argv[++i];
+        } else if ((strcmp(argv[i], "--format") == 0) && (i+1 < argc)){
+            i++;
+            if (strcmp(argv[i], "csv") == 0){
+                format = EXPORT_CSV;
+            } else if (strcmp(argv[i], "ndjson") == 0){
+                format = EXPORT_NDJSON;
+            } else{
+                fprintf(stderr, "Unknown export format '%s'.\n", argv[i]);
+                return 1;
+            }
+        } else{
+            fprintf(stderr, "Input 'qlock export' not correctly formatted.\n");
+            return 1;
+        }
+    }
+
+    // Only the connections the chosen export reads are opened
+    if (all || project != NULL){
+        if (ctx_mdb(ctx) == NULL){
+            return 1;
+        }
+        if (project != NULL && project_exists(ctx->mdb, project) != 1){
+            fprintf(stderr, "Project %s does not exist.\n", project);
+            return 1;
+        }
+    } else if ((db = ctx_db(ctx)) == NULL){
+        return 1;
+    }
+    // Rows go through a stream of their own with a large buffer, since stdout
+    // may already have been written to and can't be rebuffered
+    fflush(stdout);
+    if ((out = fdopen(dup(fileno(stdout)), "w")) == NULL){
+        fprintf(stderr, "Could not open stdout for the export.\n");
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, EXPORT_BUF_SZ);
+    export_header(format, out);
+    if (all){
+        n = export_all_projects(ctx->mdb, format, out);
+    } else if (project != NULL){
+        if ((dbpath = project_db_path(project)) == NULL){
+            n = -1;
+        } else{
+            n = export_project_file(dbpath, project, format, out);
+            free(dbpath);
+        }
+    } else{
+        n = export_project(db, ctx->name, format, out);
+    }
+    fclose(out);
+    return (n < 0);
+}
+
+// print_active() writes the id and name of a visited task
+static int print_active(struct task_row *t, void *ctx){
+    printf("%d\t%s\n", t->id, t->name);
+    return 0;
+}
+
+// cmd_active() processes 'qlock active'
+static int cmd_active(struct qlock_ctx *ctx, int argc, char **argv){
+    each_task(ctx->db, TASKS_OPEN, print_active, NULL);
+    return 0;
+}
+
+// print_open_session() writes the project, id and running time of a visited
+// open session, as of the time in ctx
+static int print_open_session(struct open_session *s, void *ctx){
+    time_t now = *(time_t*)ctx;
+
+    printf("%s\t%d\t", s->project, s->id);
+    print_hms((now > s->start) ? now - s->start : 0);
+    printf("\n");
+    return 0;
+}
+
+// cmd_active_all() processes 'qlock active --all', which reads the master
+// db's index of open sessions rather than opening every project
+static int cmd_active_all(struct qlock_ctx *ctx, int argc, char **argv){
+    time_t now = time(NULL);
+    int n;
+
+    if (each_open_session(ctx->mdb, print_open_session, &now) < 0){
+        fprintf(stderr, "Could not list the open sessions of every project.\n");
+        return 1;
+    }
+    if ((n = count_unindexed_projects(ctx->mdb)) > 0){
+        fprintf(stderr, "%d projects have not been indexed since qlock was upgraded; run 'qlock reconcile' to add them.\n", n);
+    }
+    return 0;
+}
+
+// cmd_reconcile() processes 'qlock reconcile'
+static int cmd_reconcile(struct qlock_ctx *ctx, int argc, char **argv){
+    int n;
+
+    if ((n = reconcile_open_sessions(ctx->mdb)) < 0){
+        fprintf(stderr, "Could not rebuild the index of open sessions.\n");
+        return 1;
+    }
+    printf("Indexed %d open sessions.\n", n);
+    return 0;
+}
+
+// cmd_rebuild() processes 'qlock rebuild'
+static int cmd_rebuild(struct qlock_ctx *ctx, int argc, char **argv){
+    if (rebuild_rollups(ctx->db) != SQLITE_OK){
+        fprintf(stderr, "Could not rebuild the daily rollups.\n");
+        return 1;
+    }
+    printf("Rebuilt the daily rollups.\n");
+    return 0;
+}
+
+// print_clock_error() explains why task #id could not be started or ended
+static void print_clock_error(int e, int id, int starting){
+    const char *verb = starting ? "start" : "end";
+
+    if (e == TASK_NOT_EXIST){
+        fprintf(stderr, "Could not %s task #%d as it does not exist.\n", verb, id);
+    } else if (e == TASK_WRONG_STATE && starting){
+        fprintf(stderr, "Could not start task #%d as it has already been started.\n", id);
+    } else if (e == TASK_WRONG_STATE){
+        fprintf(stderr, "Could not end task #%d as it has not been started.\n", id);
+    } else{
+        fprintf(stderr, "Could not %s task #%d.\n", verb, id);
+    }
+}
+
+// clock_command() ends the tasks in outs and starts those in ins at once, and
+// reports what was done. If one task fails none of them are clocked. Returns
+// the exit status of the command.
+static int clock_command(struct qlock_ctx *ctx, int *outs, int nout, int *ins, int nin){
+    int failed = 0;
+    int e = clock_tasks(ctx->db, outs, nout, ins, nin, &failed);
+
+    if (e != TASK_OK){
+        if (failed < 0){
+            fprintf(stderr, "Could not clock tasks in or out.\n");
+        } else if (failed < nout){
+            print_clock_error(e, outs[failed], 0);
+        } else{
+            print_clock_error(e, ins[failed-nout], 1);
+        }
+        if (nout + nin > 1){
+            fprintf(stderr, "No tasks were clocked in or out.\n");
+        }
+        return 1;
+    }
+    for (int i = 0; i < nout; i++){
+        printf("Ended task #%d.\n", outs[i]);
+    }
+    for (int i = 0; i < nin; i++){
+        printf("Started task #%d.\n", ins[i]);
+    }
+    return 0;
+}
+
+// resolve_task() reads a task given on the command line, either as its id or
+// as the start of its name. Returns 0 on success and -1, having said why, if
+// the name doesn't pick out exactly one task.
+static int resolve_task(struct qlock_ctx *ctx, char *arg, int *id){
+    if (arg[0] != '\0' && arg[strspn(arg, "0123456789")] == '\0'){
+        *id = atoi(arg);
+        return 0;
+    }
+    switch (find_task(ctx->db, arg, id)){
+        case 1:
+            return 0;
+        case 0:
+            fprintf(stderr, "No task name starts with '%s'.\n", arg);
+            break;
+        case -2:
+            fprintf(stderr, "More than one task name starts with '%s'; use its id or qlock search.\n", arg);
+            break;
+        default:
+            fprintf(stderr, "Could not look up task '%s'.\n", arg);
+    }
+    return -1;
+}
+
+// parse_ids() reads the tasks given from argv[first] on into a malloc'd array
+// of ids, returning the number of them. Returns 0 if none were given and -1 if
+// one of them could not be resolved.
+static int parse_ids(struct qlock_ctx *ctx, int argc, char **argv, int first, int **ids){
+    int n = argc - first;
+
+    if (n < 1 || (*ids = malloc(n*sizeof(int))) == NULL){
+        return 0;
+    }
+    for (int i = 0; i < n; i++){
+        if (resolve_task(ctx, argv[first+i], &(*ids)[i]) != 0){
+            free(*ids);
+            return -1;
+        }
+    }
+    return n;
+}
+
+// cmd_in() processes 'qlock in N [M ...]'
+static int cmd_in(struct qlock_ctx *ctx, int argc, char **argv){
+    int *ids;
+    int n;
+
+    if ((n = parse_ids(ctx, argc, argv, 2, &ids)) <= 0){
+        if (n == 0){
+            fprintf(stderr, "Input 'qlock in' not correctly formatted.\n");
+        }
+        return 1;
+    }
+    n = clock_command(ctx, NULL, 0, ids, n);
+    free(ids);
+    return n;
+}
+
+// cmd_out() processes 'qlock out N [M ...]'
+static int cmd_out(struct qlock_ctx *ctx, int argc, char **argv){
+    int *ids;
+    int n;
+
+    if ((n = parse_ids(ctx, argc, argv, 2, &ids)) <= 0){
+        if (n == 0){
+            fprintf(stderr, "Input 'qlock out' not correctly formatted.\n");
+        }
+        return 1;
+    }
+    n = clock_command(ctx, ids, n, NULL, 0);
+    free(ids);
+    return n;
+}
+
+// cmd_out_all() processes 'qlock out --all'
+static int cmd_out_all(struct qlock_ctx *ctx, int argc, char **argv){
+    int *ids;
+    int n;
+
+    if ((n = end_all_tasks(ctx->db, &ids)) < 0){
+        fprintf(stderr, "Could not end the active tasks.\n");
+        return 1;
+    }
+    if (n == 0){
+        printf("No tasks are active.\n");
+    }
+    for (int i = 0; i < n; i++){
+        printf("Ended task #%d.\n", ids[i]);
+    }
+    free(ids);
+    return 0;
+}
+
+// cmd_swap() processes 'qlock swap A B', ending task A and starting task B
+static int cmd_swap(struct qlock_ctx *ctx, int argc, char **argv){
+    int from, to;
+
+    if (resolve_task(ctx, argv[2], &from) != 0 || resolve_task(ctx, argv[3], &to) != 0){
+        return 1;
+    }
+    return clock_command(ctx, &from, 1, &to, 1);
+}
+
+// print_match() writes a task found by a search
+static int print_match(struct task_row *t, void *ctx){
+    printf("%d\t%s\t%s\n", t->id, t->name, t->desc);
+    return 0;
+}
+
+// cmd_search() processes 'qlock search QUERY', listing the tasks whose name
+// or description has words starting with those of the query
+static int cmd_search(struct qlock_ctx *ctx, int argc, char **argv){
+    char *query;
+    size_t l = 0;
+    int n;
+
+    if (argc < 3){
+        fprintf(stderr, "Input 'qlock search' not correctly formatted.\n");
+        return 1;
+    }
+    for (int i = 2; i < argc; i++){
+        l += strlen(argv[i]) + 1;
+    }
+    if ((query = arena_alloc(&ctx->arena, l)) == NULL){
+        return 1;
+    }
+    query[0] = '\0';
+    for (int i = 2; i < argc; i++){
+        strcat(strcat(query, argv[i]), (i+1 < argc) ? " " : "");
+    }
+    if ((n = search_tasks(ctx->db, query, SEARCH_LIMIT, print_match, NULL)) < 0){
+        fprintf(stderr, "Could not search the tasks.\n");
+    } else if (n == 0){
+        printf("No tasks match '%s'.\n", query);
+    }
+    return 0;
+}
+
+// cmd_watch() processes 'qlock watch', showing the running total of every
+// open task once a second until interrupted. Totals are read once and then
+// counted up from the clock; the db is only read again when its data_version
+// says another process has written to it, or the active project changes.
+static int cmd_watch(struct qlock_ctx *ctx, int argc, char **argv){
+    struct open_total *o = NULL;
+    int tty = isatty(fileno(stdout));
+    long long seen = -1;
+    long long v;
+    time_t now;
+    int stale;
+    int n = 0;
+
+    for (;;){
+        ctx_refresh(ctx);
+        stale = (ctx->db == NULL);
+        if (ctx_db(ctx) == NULL || (v = get_data_version(ctx->db)) < 0){
+            return 1;
+        }
+        if (stale || v != seen){
+            arena_reset(&ctx->arena);
+            if ((n = get_open_totals(ctx->db, &ctx->arena, &o)) < 0){
+                fprintf(stderr, "Could not read the active tasks.\n");
+                return 1;
+            }
+            seen = v;
+        }
+        now = time(NULL);
+        if (tty){
+            printf("\033[H\033[J");
+        }
+        printf("Project %s\n", ctx->name);
+        if (n == 0){
+            printf("No tasks are active.\n");
+        }
+        for (int i = 0; i < n; i++){
+            printf("%d\t%s\t", o[i].id, o[i].name);
+            print_hms(o[i].closed + (now - o[i].start));
+            printf("\n");
+        }
+        if (!tty){
+            printf("\n");
+        }
+        fflush(stdout);
+        sleep(WATCH_INTERVAL_SEC);
+    }
+}
+
+// print_report() prints every task of a report with its days, then the total
+// of the whole report
+static void print_report(struct project_report *r){
+    long long total = 0;
+
+    for (int i = 0; i < r->num_tasks; i++){
+        printf("#%d %s: ", r->tasks[i].id, r->tasks[i].name);
+        print_hms(r->tasks[i].total);
+        printf("\n");
+        for (int k = 0; k < r->tasks[i].num_days; k++){
+            printf("  ");
+            print_day(&r->tasks[i].days[k], NULL);
+        }
+        total += r->tasks[i].total;
+    }
+    printf("-----------\nTotal: ");
+    print_hms(total);
+    printf("\n");
+}
+
+// cmd_report() processes 'qlock report [--workers N]', breaking down the time
+// of every task of the project by day in one run. The tasks are shared out
+// between N threads, or one per core.
+static int cmd_report(struct qlock_ctx *ctx, int argc, char **argv){
+    struct project_report r;
+    char *dbpath;
+    int workers = 0;
+    int n;
+
+    if (argc == 4 && strcmp(argv[2], "--workers") == 0){
+        workers = atoi(argv[3]);
+    }
+    if (argc != 2 && workers < 1){
+        fprintf(stderr, "Input 'qlock report' not correctly formatted.\n");
+        return 1;
+    }
+    dbpath = project_db_path(ctx->name);
+    n = report_project(dbpath, workers, &r);
+    free(dbpath);
+    if (n < 0){
+        fprintf(stderr, "Could not report on project %s.\n", ctx->name);
+        return 1;
+    }
+    print_report(&r);
+    report_free(&r);
+    return 0;
+}
+
+// print_all_report() prints every project of a report with the total of each
+// of its tasks, then the total of every project. Projects which have no db
+// yet are left out, as they have no time to show, and ones whose db could not
+// be upgraded are named as such.
+static void print_all_report(struct all_report *r){
+    struct project_summary *p;
+
+    for (int i = 0; i < r->num_projects; i++){
+        p = &r->projects[i];
+        if (p->missing){
+            continue;
+        }
+        if (p->outdated){
+            printf("%s: not upgraded\n", p->name);
+            continue;
+        }
+        printf("%s: ", p->name);
+        print_hms(p->total);
+        printf("\n");
+        for (int k = 0; k < p->num_tasks; k++){
+            printf("  #%d %s: ", p->tasks[k].id, p->tasks[k].name);
+            print_hms(p->tasks[k].seconds);
+            printf("\n");
+        }
+    }
+    printf("-----------\nTotal: ");
+    print_hms(r->total);
+    printf("\n");
+}
+
+// cmd_report_all() processes 'qlock report --all [--workers N]', summing the
+// time of every task of every project. The projects are shared out between N
+// threads, or one per core.
+static int cmd_report_all(struct qlock_ctx *ctx, int argc, char **argv){
+    struct all_report r;
+    int workers = 0;
+
+    if (argc == 5 && strcmp(argv[3], "--workers") == 0){
+        workers = atoi(argv[4]);
+    }
+    if (argc != 3 && workers < 1){
+        fprintf(stderr, "Input 'qlock report --all' not correctly formatted.\n");
+        return 1;
+    }
+    if (report_all(ctx->mdb, workers, &r) < 0){
+        fprintf(stderr, "Could not report on every project.\n");
+        return 1;
+    }
+    print_all_report(&r);
+    all_report_free(&r);
+    return 0;
+}
+
+// cmd_import() processes 'qlock import FILE', reading stdin if FILE is '-'
+static int cmd_import(struct qlock_ctx *ctx, int argc, char **argv){
+    struct import_stats st;
+    FILE *in = stdin;
+    int ret = 1;
+
+    if ((strcmp(argv[2], "-") != 0) && ((in = fopen(argv[2], "r")) == NULL)){
+        fprintf(stderr, "Could not open %s.\n", argv[2]);
+    } else if (import_tasks(ctx->db, in, &st) != 0){
+        fprintf(stderr, "Nothing was imported from %s.\n", argv[2]);
+    } else{
+        printf("Imported %ld tasks and %ld timestamps.\n", st.tasks, st.stamps);
+        ret = 0;
+    }
+    if (in != NULL && in != stdin){
+        fclose(in);
+    }
+    return ret;
+}
+
+// parse_time() reads a time given as a local date (YYYY-MM-DD), a local date
+// and time (YYYY-MM-DDTHH:MM[:SS], or with a space for the T) or seconds since
+// the epoch (@N). A bare date is the start of that day, or the end of it if
+// end_of_day is set. Returns 0 on success and -1 if the time can't be read.
+static int parse_time(const char *s, int end_of_day, time_t *t){
+    struct tm tm = {0};
+    long long secs;
+    int n = 0;
+    int k = 0;
+
+    if (s[0] == '@'){
+        if (sscanf(s+1, "%lld%n", &secs, &n) != 1 || s[n+1] != '\0'){
+            return -1;
+        }
+        *t = secs;
+        return 0;
+    }
+    if (sscanf(s, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) != 3){
+        return -1;
+    }
+    if (s[n] == '\0'){
+        tm.tm_mday += end_of_day;
+    } else if ((s[n] == 'T' || s[n] == ' ')
+               && sscanf(s+n+1, "%2d:%2d%n:%2d%n", &tm.tm_hour, &tm.tm_min, &k, &tm.tm_sec, &k) >= 2){
+        if (s[n+1+k] != '\0'){
+            return -1;
+        }
+    } else{
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    if ((*t = mktime(&tm)) == -1){
+        return -1;
+    }
+    return 0;
+}
+
+// cmd_elapsed() processes 'qlock elapsed N [--since T] [--until T]'. Without
+// a window the whole history is read from the daily rollups.
+static int cmd_elapsed(struct qlock_ctx *ctx, int argc, char **argv){
+    time_t since = 0;
+    time_t until = time(NULL) + 1;
+    int ranged = 0;
+    int total = 0;
+    int id, e;
+
+    if (argc < 3){
+        fprintf(stderr, "Input 'qlock elapsed' not correctly formatted.\n");
+        return 1;
+    }
+    for (int i = 3; i < argc; i++){
+        if ((strcmp(argv[i], "--since") == 0) && (i+1 < argc)){
+            e = parse_time(argv[++i], 0, &since);
+        } else if ((strcmp(argv[i], "--until") == 0) && (i+1 < argc)){
+            e = parse_time(argv[++i], 1, &until);
+        } else{
+            fprintf(stderr, "Input 'qlock elapsed' not correctly formatted.\n");
+            return 1;
+        }
+        if (e != 0){
+            fprintf(stderr, "Could not read the time '%s'.\n", argv[i]);
+            return 1;
+        }
+        ranged = 1;
+    }
+
+    id = atoi(argv[2]);
+    if (ranged){
+        e = get_elapsed_range(ctx->db, id, since, until, print_day, &total);
+    } else{
+        e = get_elapsed_breakdown(ctx->db, id, print_day, &total);
+    }
+    if (e != 0){
+        fprintf(stderr, "Task #%d does not exist.\n", id);
+    } else{
+        printf("-----------\nTotal: ");
+        print_hms(total);
+        printf("\n");
+    }
+    return 0;
+}
+
+// cmd_new_project() processes 'qlock new p'
+static int cmd_new_project(struct qlock_ctx *ctx, int argc, char **argv){
+    char name[MAX_PROJ_NAME_SZ];
+    int e;
+
+    printf("Enter a name for the project: ");
+    fgets(name, MAX_PROJ_NAME_SZ, stdin);
+    sscanf(name, "%[^\n]s", name);
+    if ((e = create_project(NULL, ctx->mdb, name)) == 0){
+        ctx_set_project(ctx, name);
+        printf("Created project %s.\n", name);
+        printf("Activated project %s.\n", name);
+    } else{
+        switch (e){
+            case -1:
+                fprintf(stderr, "Must provide a name for the project.\n");
+
+                break;
+            case -2:
+                fprintf(stderr, "Project %s already exists.\n", name);
+                break;
+        }
+    }
+    return 0;
+}
+
+// cmd_new_task() processes 'qlock new t'
+static int cmd_new_task(struct qlock_ctx *ctx, int argc, char **argv){
+    char name[MAX_TASK_NAME_SZ];
+    char desc[MAX_TASK_DESC_SZ];
+    int id;
+
+    printf("Enter a name for the task: ");
+    fgets(name, MAX_TASK_NAME_SZ, stdin);
+    sscanf(name, "%[^\n]s", name);
+    printf("Enter a description for the task: ");
+    fgets(desc, MAX_TASK_DESC_SZ, stdin);
+    sscanf(desc, "%[^\n]s", desc);
+    id = create_task(ctx->db, name, desc);
+
+    printf("Created task #%d.\n", id);
+    return 0;
+}
+
+// cmd_switch() processes 'qlock switch NAME'
+static int cmd_switch(struct qlock_ctx *ctx, int argc, char **argv){
+    int e;
+
+    if ((e = switch_active_project(ctx->mdb, argv[2])) != 0){
+        fprintf(stderr, "Failed to switch to project '%s'--Error %d.\n", argv[2], e);
+    } else{
+        ctx_set_project(ctx, argv[2]);
+    }
+    return 0;
+}
+
+// print_project() writes a visited project name
+static int print_project(char *name, void *ctx){
+    printf("%s\n", name);
+    return 0;
+}
+
+// cmd_list_projects() processes 'qlock list p'
+static int cmd_list_projects(struct qlock_ctx *ctx, int argc, char **argv){
+    each_project(ctx->mdb, print_project, NULL);
+    return 0;
+}
+
+// cmd_list_tasks() processes 'qlock list t'
+static int cmd_list_tasks(struct qlock_ctx *ctx, int argc, char **argv){
+    print_all_tasks(ctx->db, stdout);
+    return 0;
+}
+
+// NEEDS_DB and NEEDS_MDB say which connections a command needs opened before
+// it runs
+#define NEEDS_DB 1
+#define NEEDS_MDB 2
+
+// command is an entry of the command table. A command matches on its name and
+// argument count, and on its second argument if it has one set. An argc of 0
+// takes any number of arguments.
+struct command{
+    const char *name;
+    const char *arg;
+    int argc;
+    int needs;
+    int (*fn)(struct qlock_ctx *ctx, int argc, char **argv);
+};
+
+static const struct command commands[] = {
+    {"in", NULL, 0, NEEDS_DB, cmd_in},
+    {"out", "--all", 3, NEEDS_DB, cmd_out_all},
+    {"out", NULL, 0, NEEDS_DB, cmd_out},
+    {"swap", NULL, 4, NEEDS_DB, cmd_swap},
+    {"active", "--all", 3, NEEDS_MDB, cmd_active_all},
+    {"active", NULL, 2, NEEDS_DB, cmd_active},
+    {"search", NULL, 0, NEEDS_DB, cmd_search},
+    {"watch", NULL, 2, NEEDS_DB, cmd_watch},
+    {"elapsed", NULL, 0, NEEDS_DB, cmd_elapsed},
+    {"report", "--all", 0, NEEDS_MDB, cmd_report_all},
+    {"report", NULL, 0, NEEDS_DB, cmd_report},
+    {"rebuild", NULL, 2, NEEDS_DB, cmd_rebuild},
+    {"reconcile", NULL, 2, NEEDS_MDB, cmd_reconcile},
+    {"import", NULL, 3, NEEDS_DB, cmd_import},
+    {"export", NULL, 0, 0, cmd_export},
+    {"new", "p", 3, NEEDS_MDB, cmd_new_project},
+    {"new", "project", 3, NEEDS_MDB, cmd_new_project},
+    {"new", "t", 3, NEEDS_DB, cmd_new_task},
+    {"new", "task", 3, NEEDS_DB, cmd_new_task},
+    {"switch", NULL, 3, NEEDS_MDB, cmd_switch},
+    {"list", "p", 3, NEEDS_MDB, cmd_list_projects},
+    {"list", "project", 3, NEEDS_MDB, cmd_list_projects},
+    {"list", "t", 3, NEEDS_DB, cmd_list_tasks},
+    {"list", "task", 3, NEEDS_DB, cmd_list_tasks},
+};
+
+// trace_command() runs a command with every statement it runs recorded, then
+// prints how long the command took and a table of the statements to stderr
+static int trace_command(struct qlock_ctx *ctx, int argc, char **argv){
+    struct timespec t0, t1;
+    int e;
+
+    set_tracing(1);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    e = handle_input(ctx, argc, argv);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    set_tracing(0);
+    fflush(stdout);
+    trace_report(stderr, argc, argv, (t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+    trace_reset();
+    return e;
+}
+
+// is_local_command() says whether a command must run in the process that was
+// given it rather than be handed to qlockd, which serves one client at a time.
+// watch never finishes, and the prompts of new and an import from stdin wait
+// on the user, so any of them would keep qlockd from serving anyone else.
+int is_local_command(int argc, char **argv){
+    if (argc > 2 && strcmp(argv[1], "--trace") == 0){
+        argc--;
+        argv++;
+    }
+    if (argc < 2){
+        return 0;
+    }
+    return (argc == 2 && strcmp(argv[1], "watch") == 0)
+        || (argc == 3 && strcmp(argv[1], "new") == 0)
+        || (argc == 3 && strcmp(argv[1], "import") == 0 && strcmp(argv[2], "-") == 0);
+}
+
+// handle_input() proccesses the command-line input and passes it to the
+// correct command, opening only the connections that command needs. A
+// leading --trace runs the rest of the command with tracing on.
+int handle_input(struct qlock_ctx *ctx, int argc, char **argv){
+    const struct command *c;
+    int e;
+
+    if (argc < 2){
+        fprintf(stderr, "Must pass at least one parameter.\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "--trace") == 0){
+        if (argc < 3){
+            fprintf(stderr, "Must pass a command to trace.\n");
+            return 1;
+        }
+        return trace_command(ctx, argc-1, argv+1);
+    }
+
+    for (size_t i = 0; i < sizeof(commands)/sizeof(commands[0]); i++){
+        c = &commands[i];
+        if (strcmp(argv[1], c->name) != 0 || (c->argc != 0 && c->argc != argc)
+            || (c->arg != NULL && (argc < 3 || strcmp(argv[2], c->arg) != 0))){
+            continue;
+        }
+        if ((c->needs & NEEDS_MDB) && ctx_mdb(ctx) == NULL){
+            return 1;
+        }
+        if ((c->needs & NEEDS_DB) && ctx_db(ctx) == NULL){
+            return 1;
+        }
+        e = c->fn(ctx, argc, argv);
+        arena_reset(&ctx->arena);
+        return e;
+    }
+    fprintf(stderr, "Input 'qlock %s' not correctly formatted.\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#include <sqlite3.h>
+
+#include "arena.h"
+
+#define MDB_PATH "./.mdb.db"
+#define ACTIVE_CACHE_PATH "./.qlock_active"
+
+// qlock_ctx holds the connections a command runs against. Each is opened the
+// first time it is asked for, so a command only pays for the ones it uses.
+// Listings made by a command are allocated in the arena, which is reset once
+// the command is done.
+struct qlock_ctx{
+    sqlite3 *db;
+    sqlite3 *mdb;
+    char *name;
+    struct arena arena;
+};
+
+int handle_input(struct qlock_ctx *ctx, int argc, char **argv);
+int is_local_command(int argc, char **argv);
+int open_master_db(sqlite3 **mdb);
+sqlite3 *ctx_mdb(struct qlock_ctx *ctx);
+sqlite3 *ctx_db(struct qlock_ctx *ctx);
+char *ctx_project(struct qlock_ctx *ctx);
+void ctx_set_project(struct qlock_ctx *ctx, char *name);
+void ctx_refresh(struct qlock_ctx *ctx);
+void close_ctx(struct qlock_ctx *ctx);
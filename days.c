@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef DAYS_H
+#define DAYS_H
+#include "days.h"
+#endif
+
+#define CALENDAR_MIN_CAP 64
+
+// tm_key() returns the yyyymmdd key of a broken down local time
+static int tm_key(const struct tm *tm){
+    return (tm->tm_year+1900)*10000 + (tm->tm_mon+1)*100 + tm->tm_mday;
+}
+
+// local_key() returns the yyyymmdd key of the local day t falls on
+static int local_key(time_t t){
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    return tm_key(&tm);
+}
+
+// midnight() sets start to the first second of the local day y-m-d and key to
+// its yyyymmdd. The date is normalized by mktime(), so d may run past the end
+// of the month, and a day skipped by a change of UTC offset gives the day
+// after it. If midnight falls in a DST gap the day starts when the clocks
+// land, and if the clocks go back over it the earlier midnight is used.
+// Returns -1 if the day can't be represented.
+static int midnight(int y, int m, int d, time_t *start, int *key){
+    struct tm tm = {0};
+
+    tm.tm_year = y - 1900;
+    tm.tm_mon = m - 1;
+    tm.tm_mday = d;
+    tm.tm_isdst = -1;
+    if ((*start = mktime(&tm)) == (time_t)-1){
+        return -1;
+    }
+    *key = tm_key(&tm);
+    // mktime() may pick either of two midnights; offsets change by whole
+    // half hours, so stepping back in those finds the first
+    while (local_key(*start - 1800) == *key){
+        *start -= 1800;
+    }
+    return 0;
+}
+
+// reserve() makes room in the calendar for one more day
+static int reserve(struct day_calendar *c){
+    time_t *starts;
+    int *keys;
+    int cap;
+
+    if (c->n + 2 <= c->cap){
+        return 0;
+    }
+    cap = (c->cap == 0) ? CALENDAR_MIN_CAP : c->cap*2;
+    if ((starts = realloc(c->starts, cap*sizeof(time_t))) == NULL){
+        return -1;
+    }
+    c->starts = starts;
+    if ((keys = realloc(c->keys, cap*sizeof(int))) == NULL){
+        return -1;
+    }
+    c->keys = keys;
+    c->cap = cap;
+    return 0;
+}
+
+// append_day() adds the day after the last covered one. As with
+// prepend_day(), a midnight which doesn't move past the last one is an error
+// rather than a day of no length, so a libc which normalizes differently
+// can't leave calendar_find() looping.
+static int append_day(struct day_calendar *c){
+    int k = c->keys[c->n];
+
+    if (reserve(c) != 0){
+        return -1;
+    }
+    if (midnight(k/10000, (k/100)%100, k%100 + 1, &c->starts[c->n+1], &c->keys[c->n+1]) != 0
+        || c->starts[c->n+1] <= c->starts[c->n]){
+        return -1;
+    }
+    c->n++;
+    return 0;
+}
+
+// prepend_day() adds the day before the first covered one. It is found from
+// the second before the first midnight rather than by date arithmetic, so a
+// skipped day is passed over.
+static int prepend_day(struct day_calendar *c){
+    time_t t = c->starts[0] - 1;
+    time_t start;
+    struct tm tm;
+    int key;
+
+    if (reserve(c) != 0){
+        return -1;
+    }
+    localtime_r(&t, &tm);
+    if (midnight(tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, &start, &key) != 0 || start >= c->starts[0]){
+        return -1;
+    }
+    memmove(c->starts+1, c->starts, (c->n+1)*sizeof(time_t));
+    memmove(c->keys+1, c->keys, (c->n+1)*sizeof(int));
+    c->starts[0] = start;
+    c->keys[0] = key;
+    c->n++;
+    return 0;
+}
+
+// first_day() starts an empty calendar off with the day t falls on
+static int first_day(struct day_calendar *c, time_t t){
+    struct tm tm;
+
+    if (reserve(c) != 0){
+        return -1;
+    }
+    localtime_r(&t, &tm);
+    if (midnight(tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, &c->starts[0], &c->keys[0]) != 0
+        || midnight(tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday + 1, &c->starts[1], &c->keys[1]) != 0){
+        return -1;
+    }
+    c->n = 1;
+    return 0;
+}
+
+// calendar_find() returns the index of the day t falls on, adding days to the
+// calendar first if t is outside of it. Each day added costs a mktime(), and
+// each lookup after that only a binary search. Returns -1 on error.
+int calendar_find(struct day_calendar *c, time_t t){
+    int lo, hi, mid;
+
+    if (c->n == 0 && first_day(c, t) != 0){
+        return -1;
+    }
+    while (t < c->starts[0]){
+        if (prepend_day(c) != 0){
+            return -1;
+        }
+    }
+    while (t >= c->starts[c->n]){
+        if (append_day(c) != 0){
+            return -1;
+        }
+    }
+    // The last day starting at or before t
+    lo = 0;
+    hi = c->n - 1;
+    while (lo < hi){
+        mid = (lo + hi + 1)/2;
+        if (c->starts[mid] <= t){
+            lo = mid;
+        } else{
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// calendar_split() splits the time from start up to stop at local midnights
+// and passes each day it touches to cb, in order, with the seconds of it that
+// fall on that day. An empty span still passes its day, with no seconds, so
+// a session ended in the second it started is credited somewhere. If cb
+// returns nonzero the split stops early.
+// Returns 0 on success, 1 if it was stopped and -1 on error.
+int calendar_split(struct day_calendar *c, time_t start, time_t stop,
+                   int (*cb)(int key, long long secs, void *ctx), void *ctx){
+    time_t end;
+    int i;
+
+    if (stop < start){
+        return 0;
+    }
+    do{
+        if ((i = calendar_find(c, start)) < 0){
+            return -1;
+        }
+        end = (c->starts[i+1] < stop) ? c->starts[i+1] : stop;
+        if ((*cb)(c->keys[i], end - start, ctx) != 0){
+            return 1;
+        }
+        start = end;
+    } while (start < stop);
+    return 0;
+}
+
+// calendar_free() frees the days of the calendar, leaving it empty
+void calendar_free(struct day_calendar *c){
+    free(c->starts);
+    free(c->keys);
+    c->starts = NULL;
+    c->keys = NULL;
+    c->n = 0;
+    c->cap = 0;
+}
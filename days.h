@@ -0,0 +1,20 @@
+#include <time.h>
+
+// day_calendar holds the local midnights of a run of consecutive days, so
+// times can be put in their day by a binary search rather than a call to
+// localtime() each. Day i runs from starts[i] up to starts[i+1] and has the
+// key keys[i] (yyyymmdd); entry n is the day just past the covered range.
+// Midnights come from mktime(), so days shortened or lengthened by DST, or
+// skipped entirely, get their real length. A zeroed calendar is empty and
+// ready to use, and grows to cover whatever times it is asked about.
+struct day_calendar{
+    time_t *starts;
+    int *keys;
+    int n;
+    int cap;
+};
+
+int calendar_find(struct day_calendar *c, time_t t);
+int calendar_split(struct day_calendar *c, time_t start, time_t stop,
+                   int (*cb)(int key, long long secs, void *ctx), void *ctx);
+void calendar_free(struct day_calendar *c);
@@ -0,0 +1,535 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <pthread.h>
+
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef TRACE_H
+#define TRACE_H
+#include "trace.h"
+#endif
+
+// stmt_def is the fixed SQL of a cached statement and the names of its
+// parameters
+struct stmt_def{
+    const char *sql;
+    const char *params[MAX_STMT_PARAMS];
+};
+
+static const struct stmt_def stmt_defs[NUM_STMTS] = {
+    [STMT_INSERT_TASK] = {"INSERT INTO task_info (id, name, description) VALUES (@id, @name, @desc);",
+                          {"@id", "@name", "@desc"}},
+    // Only inserts for a task which exists, and the sessions_open index
+    // fails the insert for a task which is already open
+    [STMT_START_SESSION] = {"INSERT INTO sessions (task_id, start) SELECT id, @ts FROM task_info WHERE id=@id "
+                            "RETURNING task_id;",
+                            {"@id", "@ts"}},
+    [STMT_END_SESSION] = {"UPDATE sessions SET end=@ts WHERE task_id=@id AND end IS NULL RETURNING start;",
+                          {"@id", "@ts"}},
+    [STMT_END_ALL_SESSIONS] = {"UPDATE sessions SET end=@ts WHERE end IS NULL RETURNING task_id, start;",
+                               {"@ts"}},
+    [STMT_OPEN_SESSION] = {"SELECT start FROM sessions WHERE task_id=@id AND end IS NULL;",
+                           {"@id"}},
+    [STMT_NUM_TIMESTAMPS] = {"SELECT COUNT(*)+COUNT(end) FROM sessions WHERE task_id=@id;",
+                             {"@id"}},
+    [STMT_TASK_EXISTS] = {"SELECT COUNT(*) FROM task_info WHERE id=@id;",
+                          {"@id"}},
+    [STMT_MAX_ID] = {"SELECT MAX(id) FROM task_info;",
+                     {NULL}},
+    [STMT_OPEN_TASKS] = {"SELECT task_info.id, task_info.name, task_info.description "
+                         "FROM sessions JOIN task_info ON task_info.id=sessions.task_id "
+                         "WHERE sessions.end IS NULL "
+                         "ORDER BY sessions.task_id;",
+                         {NULL}},
+    [STMT_OPEN_TOTALS] = {"SELECT task_info.id, task_info.name, sessions.start, "
+                          "(SELECT COALESCE(SUM(seconds), 0) FROM task_daily WHERE task_daily.task_id=sessions.task_id) "
+                          "FROM sessions JOIN task_info ON task_info.id=sessions.task_id "
+                          "WHERE sessions.end IS NULL "
+                          "ORDER BY sessions.task_id;",
+                          {NULL}},
+    [STMT_TASK_TOTALS] = {"SELECT task_info.id, task_info.name, "
+                           "(SELECT COALESCE(SUM(seconds), 0) FROM task_daily WHERE task_daily.task_id=task_info.id), "
+                           "sessions.start "
+                           "FROM task_info LEFT JOIN sessions ON sessions.task_id=task_info.id AND sessions.end IS NULL "
+                           "ORDER BY task_info.id;",
+                           {NULL}},
+    [STMT_ALL_TASKS] = {"SELECT id, name, description FROM task_info ORDER BY id;",
+                        {NULL}},
+    [STMT_SEARCH_TASKS] = {"SELECT task_info.id, task_info.name, task_info.description "
+                           "FROM task_fts JOIN task_info ON task_info.id=task_fts.rowid "
+                           "WHERE task_fts MATCH @query "
+                           "ORDER BY bm25(task_fts, 10.0, 1.0) LIMIT @limit;",
+                           {"@query", "@limit"}},
+    [STMT_FIND_TASK] = {"SELECT task_info.id, task_info.name=@name COLLATE NOCASE "
+                        "FROM task_fts JOIN task_info ON task_info.id=task_fts.rowid "
+                        "WHERE task_fts MATCH @query AND task_info.name LIKE @like ESCAPE '\\' "
+                        "ORDER BY 2 DESC LIMIT 2;",
+                        {"@name", "@query", "@like"}},
+    [STMT_FIND_TASK_SCAN] = {"SELECT id, name=@name COLLATE NOCASE FROM task_info "
+                             "WHERE name LIKE @like ESCAPE '\\' "
+                             "ORDER BY 2 DESC LIMIT 2;",
+                             {"@name", "@like"}},
+    [STMT_SESSION_BEFORE] = {"SELECT start, end FROM sessions WHERE task_id=@id AND start<@since "
+                             "ORDER BY start DESC LIMIT 1;",
+                             {"@id", "@since"}},
+    [STMT_SESSIONS_BETWEEN] = {"SELECT start, end FROM sessions "
+                               "WHERE task_id=@id AND start>=@since AND start<@until "
+                               "ORDER BY start;",
+                               {"@id", "@since", "@until"}},
+    [STMT_CLOSED_SESSIONS] = {"SELECT task_id, start, end FROM sessions WHERE end IS NOT NULL "
+                              "ORDER BY task_id, start;",
+                              {NULL}},
+    [STMT_ADD_ROLLUP] = {"INSERT INTO task_daily (task_id, day, seconds) VALUES (@id, @day, @secs) "
+                         "ON CONFLICT(task_id, day) DO UPDATE SET seconds=seconds+excluded.seconds;",
+                         {"@id", "@day", "@secs"}},
+    [STMT_TASK_ROLLUPS] = {"SELECT day, seconds FROM task_daily WHERE task_id=@id ORDER BY day;",
+                           {"@id"}},
+    [STMT_CLEAR_ROLLUPS] = {"DELETE FROM task_daily;",
+                            {NULL}},
+    [STMT_IMPORT_TASK] = {"INSERT INTO task_info (id, name, description) VALUES (@id, @name, @desc) "
+                          "ON CONFLICT(id) DO NOTHING;",
+                          {"@id", "@name", "@desc"}},
+    [STMT_IMPORT_STAGING] = {"CREATE TEMP TABLE IF NOT EXISTS import_stamps "
+                             "(id INTEGER NOT NULL, timestamp INTEGER NOT NULL);",
+                             {NULL}},
+    [STMT_IMPORT_STAMP] = {"INSERT INTO temp.import_stamps (id, timestamp) VALUES (@id, @ts);",
+                           {"@id", "@ts"}},
+    [STMT_IMPORT_TARGETS] = {"SELECT t.id, task_info.id IS NOT NULL FROM "
+                             "(SELECT DISTINCT id FROM temp.import_stamps) AS t "
+                             "LEFT JOIN task_info ON task_info.id=t.id "
+                             "LEFT JOIN sessions AS open ON open.task_id=t.id AND open.end IS NULL "
+                             "WHERE task_info.id IS NULL OR open.task_id IS NOT NULL "
+                             "ORDER BY t.id;",
+                             {NULL}},
+    [STMT_IMPORT_SESSIONS] = {"INSERT INTO sessions (task_id, start, end) "
+                              "SELECT id, timestamp, next FROM "
+                              "(SELECT id, timestamp, LEAD(timestamp) OVER w AS next, ROW_NUMBER() OVER w AS n "
+                              "FROM temp.import_stamps WINDOW w AS (PARTITION BY id ORDER BY timestamp, rowid)) "
+                              "WHERE n%2=1 RETURNING task_id, start, end;",
+                              {NULL}},
+    // The imported stamps are paired up as in STMT_IMPORT_SESSIONS
+    [STMT_IMPORT_OVERLAPS] = {"SELECT p.id, p.timestamp, p.next FROM "
+                              "(SELECT id, timestamp, LEAD(timestamp) OVER w AS next, ROW_NUMBER() OVER w AS n "
+                              "FROM temp.import_stamps WINDOW w AS (PARTITION BY id ORDER BY timestamp, rowid)) AS p "
+                              "WHERE p.n%2=1 AND EXISTS (SELECT 1 FROM sessions WHERE task_id=p.id "
+                              "AND (p.next IS NULL OR start<p.next) AND end>p.timestamp) "
+                              "ORDER BY p.id, p.timestamp;",
+                              {NULL}},
+    [STMT_IMPORT_CLEAR] = {"DELETE FROM temp.import_stamps;",
+                           {NULL}},
+    [STMT_EXPORT_ROWS] = {"SELECT task_info.id, task_info.name, task_info.description, sessions.start, sessions.end "
+                          "FROM task_info LEFT JOIN sessions ON sessions.task_id=task_info.id "
+                          "ORDER BY task_info.id, sessions.start;",
+                          {NULL}},
+    [STMT_DEACTIVATE_PROJECTS] = {"UPDATE proj_info SET active=0;",
+                                  {NULL}},
+    [STMT_PROJECT_EXISTS] = {"SELECT COUNT(*) FROM proj_info WHERE name=@name;",
+                             {"@name"}},
+    [STMT_ACTIVATE_PROJECT] = {"UPDATE proj_info SET active=1 WHERE name=@name;",
+                               {"@name"}},
+    [STMT_INSERT_PROJECT] = {"INSERT INTO proj_info (name, active) VALUES (@name, 1);",
+                             {"@name"}},
+    [STMT_ACTIVE_PROJECT] = {"SELECT name FROM proj_info WHERE active=1;",
+                             {NULL}},
+    [STMT_ALL_PROJECTS] = {"SELECT name FROM proj_info;",
+                           {NULL}},
+    [STMT_SAVEPOINT] = {"SAVEPOINT qlock;",
+                        {NULL}},
+    [STMT_RELEASE] = {"RELEASE qlock;",
+                      {NULL}},
+    [STMT_ROLLBACK_TO] = {"ROLLBACK TO qlock;",
+                          {NULL}},
+    [STMT_BEGIN_IMMEDIATE] = {"BEGIN IMMEDIATE;",
+                              {NULL}},
+    [STMT_COMMIT] = {"COMMIT;",
+                     {NULL}},
+    [STMT_DATA_VERSION] = {"PRAGMA data_version;",
+                           {NULL}},
+    // The index of open sessions in the master db is kept by a connection of
+    // its own, which each project connection holds, so clock events commit
+    // to the project db without taking the master db's lock
+    [STMT_OPEN_STARTS] = {"SELECT task_id, start FROM sessions WHERE end IS NULL;",
+                          {NULL}},
+    [STMT_UNINDEX_PROJECT] = {"DELETE FROM open_sessions WHERE project=@project;",
+                              {"@project"}},
+    [STMT_ALL_OPEN_SESSIONS] = {"SELECT project, task_id, started_at FROM open_sessions ORDER BY project, task_id;",
+                                {NULL}},
+    [STMT_CLEAR_OPEN_SESSIONS] = {"DELETE FROM open_sessions;",
+                                  {NULL}},
+    [STMT_ADD_OPEN_SESSION] = {"INSERT OR REPLACE INTO open_sessions (project, task_id, started_at) VALUES (@project, @id, @ts);",
+                               {"@project", "@id", "@ts"}},
+    [STMT_MARK_INDEXED] = {"UPDATE proj_info SET indexed=1 WHERE name=@project;",
+                           {"@project"}},
+    [STMT_MARK_ALL_INDEXED] = {"UPDATE proj_info SET indexed=1;",
+                               {NULL}},
+    [STMT_UNINDEXED_PROJECTS] = {"SELECT COUNT(*) FROM proj_info WHERE indexed=0;",
+                                 {NULL}},
+};
+
+// stmt_cache holds the statements prepared so far on a single connection.
+// Statements are prepared the first time they are asked for. It also tracks
+// how deep the open savepoints go and at which depth begin_savepoint() started
+// the transaction, if it did, and the master db and project name under which
+// the connection's clock events are indexed, if they are, along with the
+// connection to the master db once one is opened.
+struct stmt_cache{
+    sqlite3 *db;
+    struct cached_stmt stmts[NUM_STMTS];
+    int depth;
+    int began_at;
+    char *index_project;
+    char *index_path;
+    sqlite3 *index_db;
+    struct stmt_cache *next;
+};
+
+// A connection is opened, used and closed by one thread, so each thread keeps
+// the caches of its own connections in a list of its own, and finding one
+// takes no lock and walks only the few connections that thread has open.
+// Hanging the cache on the connection with sqlite3_set_clientdata() would
+// need SQLite 3.44. Only the tracing flag is shared, under tracing_lock.
+static __thread struct stmt_cache *caches = NULL;
+static pthread_mutex_t tracing_lock = PTHREAD_MUTEX_INITIALIZER;
+static int tracing = 0;
+
+// find_cache() returns the statement cache of a connection opened by this
+// thread, creating it if create is set
+static struct stmt_cache *find_cache(sqlite3 *db, int create){
+    struct stmt_cache *c;
+
+    for (c = caches; c != NULL; c = c->next){
+        if (c->db == db){
+            return c;
+        }
+    }
+    if (create && (c = calloc(1, sizeof(struct stmt_cache))) != NULL){
+        c->db = db;
+        c->next = caches;
+        caches = c;
+    }
+    return c;
+}
+
+// get_stmt() returns statement s for the connection, preparing it on first use.
+// The statement is reset and its bindings cleared before it is handed out.
+// Returns NULL if the statement could not be prepared.
+struct cached_stmt *get_stmt(sqlite3 *db, STMT_ID s){
+    struct stmt_cache *c;
+    struct cached_stmt *cs;
+    const struct stmt_def *def = &stmt_defs[s];
+    int e;
+
+    if ((c = find_cache(db, 1)) == NULL){
+        return NULL;
+    }
+    cs = &c->stmts[s];
+    if (cs->stmt == NULL){
+        e = sqlite3_prepare_v3(db, def->sql, -1, SQLITE_PREPARE_PERSISTENT, &cs->stmt, NULL);
+        if (e != SQLITE_OK){
+            fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+            sqlite3_finalize(cs->stmt);
+            cs->stmt = NULL;
+            return NULL;
+        }
+        for (int i = 0; i < MAX_STMT_PARAMS && def->params[i] != NULL; i++){
+            cs->params[i] = sqlite3_bind_parameter_index(cs->stmt, def->params[i]);
+        }
+    } else{
+        sqlite3_reset(cs->stmt);
+        sqlite3_clear_bindings(cs->stmt);
+    }
+    return cs;
+}
+
+// release_stmt() gives up a statement after an error. Cached statements are
+// reset so they can be handed out again while any other statement is
+// finalized.
+void release_stmt(sqlite3 *db, sqlite3_stmt *stmt){
+    struct stmt_cache *c;
+
+    if (stmt == NULL){
+        return;
+    }
+    if ((c = find_cache(db, 0)) != NULL){
+        for (int i = 0; i < NUM_STMTS; i++){
+            if (c->stmts[i].stmt == stmt){
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                return;
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+// exec_stmt() runs a cached statement which takes no parameters and returns
+// no rows
+int exec_stmt(sqlite3 *db, STMT_ID s){
+    struct cached_stmt *cs;
+    int e;
+
+    if ((cs = get_stmt(db, s)) == NULL){
+        return SQLITE_ERROR;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+    }
+    sqlite3_reset(cs->stmt);
+    if (e != SQLITE_DONE){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+        return e;
+    }
+    return SQLITE_OK;
+}
+
+// get_data_version() returns the data_version of the db, which changes
+// whenever another connection commits to it, or -1 on error. Comparing it to
+// an earlier value tells whether anything read since then may be stale.
+long long get_data_version(sqlite3 *db){
+    struct cached_stmt *cs;
+    long long v = -1;
+    int e;
+
+    if ((cs = get_stmt(db, STMT_DATA_VERSION)) == NULL){
+        return -1;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        v = sqlite3_column_int64(cs->stmt, 0);
+    }
+    sqlite3_reset(cs->stmt);
+    if (e != SQLITE_DONE){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+        return -1;
+    }
+    return v;
+}
+
+// begin_savepoint() opens a savepoint. Outside of a transaction this starts
+// one, inside of one it nests, so functions which need several writes to land
+// together can use it whether or not their caller has a transaction open.
+// Transactions are started with BEGIN IMMEDIATE, which takes the write lock
+// up front, so whatever is read inside the savepoint can't be changed by
+// another process before the writes that depend on it.
+int begin_savepoint(sqlite3 *db){
+    struct stmt_cache *c;
+    int e;
+
+    if ((c = find_cache(db, 1)) == NULL){
+        return SQLITE_NOMEM;
+    }
+    if (sqlite3_get_autocommit(db)){
+        if ((e = exec_stmt(db, STMT_BEGIN_IMMEDIATE)) != SQLITE_OK){
+            return e;
+        }
+        c->began_at = c->depth + 1;
+    }
+    if ((e = exec_stmt(db, STMT_SAVEPOINT)) != SQLITE_OK){
+        if (c->began_at == c->depth + 1){
+            exec_stmt(db, STMT_COMMIT);
+            c->began_at = 0;
+        }
+        return e;
+    }
+    c->depth++;
+    return SQLITE_OK;
+}
+
+// end_savepoint() closes the innermost savepoint's bookkeeping, committing
+// the transaction if begin_savepoint() started it
+static int end_savepoint(sqlite3 *db){
+    struct stmt_cache *c;
+    int e = SQLITE_OK;
+
+    if ((c = find_cache(db, 0)) == NULL || c->depth == 0){
+        return SQLITE_OK;
+    }
+    if (c->began_at == c->depth){
+        e = exec_stmt(db, STMT_COMMIT);
+        c->began_at = 0;
+    }
+    c->depth--;
+    return e;
+}
+
+// release_savepoint() keeps the writes made since the last begin_savepoint(),
+// committing them if the savepoint started the transaction
+int release_savepoint(sqlite3 *db){
+    int e;
+
+    if ((e = exec_stmt(db, STMT_RELEASE)) != SQLITE_OK){
+        return e;
+    }
+    return end_savepoint(db);
+}
+
+// rollback_savepoint() undoes the writes made since the last
+// begin_savepoint() and closes the savepoint
+int rollback_savepoint(sqlite3 *db){
+    exec_stmt(db, STMT_ROLLBACK_TO);
+    exec_stmt(db, STMT_RELEASE);
+    return end_savepoint(db);
+}
+
+// busy_timeout() returns how many milliseconds a connection waits on a locked
+// db, taken from QLOCK_BUSY_TIMEOUT if it is set
+static int busy_timeout(void){
+    char *env = getenv("QLOCK_BUSY_TIMEOUT");
+    char *end;
+    long ms;
+
+    if (env == NULL){
+        return DEFAULT_BUSY_TIMEOUT_MS;
+    }
+    ms = strtol(env, &end, 10);
+    if (end == env || *end != '\0' || ms < 0 || ms > 3600000){
+        return DEFAULT_BUSY_TIMEOUT_MS;
+    }
+    return ms;
+}
+
+// open_db() opens a connection which waits out other processes' locks for up
+// to the busy timeout rather than failing straight away. Writable connections
+// switch the db to WAL journaling, so readers and the writer don't block each
+// other. On failure the connection is closed and *db is left NULL.
+int open_db(char *path, sqlite3 **db, int flags){
+    int e;
+
+    if ((e = sqlite3_open_v2(path, db, flags, NULL)) != SQLITE_OK){
+        sqlite3_close(*db);
+        *db = NULL;
+        return e;
+    }
+    sqlite3_busy_timeout(*db, busy_timeout());
+    // Registering the connection lets set_tracing() find it later
+    find_cache(*db, 1);
+    pthread_mutex_lock(&tracing_lock);
+    if (tracing){
+        trace_attach(*db, 1);
+    }
+    pthread_mutex_unlock(&tracing_lock);
+    if (!(flags & SQLITE_OPEN_READWRITE)){
+        return SQLITE_OK;
+    }
+    if ((e = sqlite3_exec(*db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL)) != SQLITE_OK){
+        close_db(*db);
+        *db = NULL;
+    }
+    return e;
+}
+
+// copy_str() returns a malloc'd copy of s, or NULL if s is NULL or there is no
+// memory for it
+static char *copy_str(const char *s){
+    char *copy;
+
+    if (s == NULL || (copy = malloc(strlen(s)+1)) == NULL){
+        return NULL;
+    }
+    return strcpy(copy, s);
+}
+
+// set_index_project() names the master db at path whose index the
+// connection's clock events are copied to, under project name. Nothing is
+// opened here: the master db is only opened by the first clock event which
+// needs it. A NULL path stops the indexing. Returns 0 on success and -1 on
+// error.
+int set_index_project(sqlite3 *db, const char *path, const char *name){
+    struct stmt_cache *c;
+    char *p = NULL;
+    char *n = NULL;
+
+    if ((c = find_cache(db, 1)) == NULL){
+        return -1;
+    }
+    if (path != NULL && ((p = copy_str(path)) == NULL || (n = copy_str(name)) == NULL)){
+        free(p);
+        return -1;
+    }
+    set_index_db(db, NULL);
+    free(c->index_path);
+    free(c->index_project);
+    c->index_path = p;
+    c->index_project = n;
+    return 0;
+}
+
+// get_index_project() returns the project the connection's clock events are
+// indexed under, or NULL if they aren't
+const char *get_index_project(sqlite3 *db){
+    struct stmt_cache *c = find_cache(db, 0);
+
+    return (c != NULL) ? c->index_project : NULL;
+}
+
+// get_index_path() returns the path of the master db the connection's clock
+// events are indexed in, or NULL if they aren't
+const char *get_index_path(sqlite3 *db){
+    struct stmt_cache *c = find_cache(db, 0);
+
+    return (c != NULL) ? c->index_path : NULL;
+}
+
+// get_index_db() returns the connection to the master db the connection's
+// clock events are indexed through, or NULL if it hasn't been opened
+sqlite3 *get_index_db(sqlite3 *db){
+    struct stmt_cache *c = find_cache(db, 0);
+
+    return (c != NULL) ? c->index_db : NULL;
+}
+
+// set_index_db() hands mdb, a connection to the master db, to the connection
+// to index its clock events through. The connection closes mdb with itself,
+// or when it is replaced. A NULL mdb closes the one held.
+void set_index_db(sqlite3 *db, sqlite3 *mdb){
+    struct stmt_cache *c;
+
+    if ((c = find_cache(db, mdb != NULL)) == NULL){
+        return;
+    }
+    if (c->index_db != NULL && c->index_db != mdb){
+        close_db(c->index_db);
+    }
+    c->index_db = mdb;
+}
+
+// set_tracing() turns statement tracing on or off for every connection this
+// thread has open with open_db(), and for every connection opened later by
+// any thread
+void set_tracing(int on){
+    pthread_mutex_lock(&tracing_lock);
+    tracing = on;
+    pthread_mutex_unlock(&tracing_lock);
+    for (struct stmt_cache *c = caches; c != NULL; c = c->next){
+        trace_attach(c->db, on);
+    }
+}
+
+// close_db() finalizes every cached statement of a connection and closes it
+int close_db(sqlite3 *db){
+    struct stmt_cache **p;
+    struct stmt_cache *c = NULL;
+
+    for (p = &caches; *p != NULL; p = &(*p)->next){
+        if ((*p)->db == db){
+            c = *p;
+            *p = c->next;
+            break;
+        }
+    }
+    if (c != NULL){
+        for (int i = 0; i < NUM_STMTS; i++){
+            sqlite3_finalize(c->stmts[i].stmt);
+        }
+        if (c->index_db != NULL){
+            close_db(c->index_db);
+        }
+        free(c->index_path);
+        free(c->index_project);
+        free(c);
+    }
+    return sqlite3_close(db);
+}
@@ -0,0 +1,80 @@
+#include <sqlite3.h>
+
+#define MAX_STMT_PARAMS 4
+#define DEFAULT_BUSY_TIMEOUT_MS 5000
+
+typedef enum {
+    STMT_INSERT_TASK,
+    STMT_START_SESSION,
+    STMT_END_SESSION,
+    STMT_END_ALL_SESSIONS,
+    STMT_OPEN_SESSION,
+    STMT_NUM_TIMESTAMPS,
+    STMT_TASK_EXISTS,
+    STMT_MAX_ID,
+    STMT_OPEN_TASKS,
+    STMT_OPEN_TOTALS,
+    STMT_TASK_TOTALS,
+    STMT_ALL_TASKS,
+    STMT_SEARCH_TASKS,
+    STMT_FIND_TASK,
+    STMT_FIND_TASK_SCAN,
+    STMT_SESSION_BEFORE,
+    STMT_SESSIONS_BETWEEN,
+    STMT_CLOSED_SESSIONS,
+    STMT_ADD_ROLLUP,
+    STMT_TASK_ROLLUPS,
+    STMT_CLEAR_ROLLUPS,
+    STMT_IMPORT_TASK,
+    STMT_IMPORT_STAGING,
+    STMT_IMPORT_STAMP,
+    STMT_IMPORT_TARGETS,
+    STMT_IMPORT_SESSIONS,
+    STMT_IMPORT_OVERLAPS,
+    STMT_IMPORT_CLEAR,
+    STMT_EXPORT_ROWS,
+    STMT_DEACTIVATE_PROJECTS,
+    STMT_PROJECT_EXISTS,
+    STMT_ACTIVATE_PROJECT,
+    STMT_INSERT_PROJECT,
+    STMT_ACTIVE_PROJECT,
+    STMT_ALL_PROJECTS,
+    STMT_SAVEPOINT,
+    STMT_RELEASE,
+    STMT_ROLLBACK_TO,
+    STMT_BEGIN_IMMEDIATE,
+    STMT_COMMIT,
+    STMT_DATA_VERSION,
+    STMT_OPEN_STARTS,
+    STMT_UNINDEX_PROJECT,
+    STMT_ALL_OPEN_SESSIONS,
+    STMT_CLEAR_OPEN_SESSIONS,
+    STMT_ADD_OPEN_SESSION,
+    STMT_MARK_INDEXED,
+    STMT_MARK_ALL_INDEXED,
+    STMT_UNINDEXED_PROJECTS,
+    NUM_STMTS
+} STMT_ID;
+
+// cached_stmt is a prepared statement along with the bind indexes of its
+// parameters, in the order they are listed for the statement in db.c
+struct cached_stmt{
+    sqlite3_stmt *stmt;
+    int params[MAX_STMT_PARAMS];
+};
+
+struct cached_stmt *get_stmt(sqlite3 *db, STMT_ID s);
+void release_stmt(sqlite3 *db, sqlite3_stmt *stmt);
+int exec_stmt(sqlite3 *db, STMT_ID s);
+long long get_data_version(sqlite3 *db);
+int begin_savepoint(sqlite3 *db);
+int release_savepoint(sqlite3 *db);
+int rollback_savepoint(sqlite3 *db);
+int open_db(char *path, sqlite3 **db, int flags);
+int set_index_project(sqlite3 *db, const char *path, const char *name);
+const char *get_index_project(sqlite3 *db);
+const char *get_index_path(sqlite3 *db);
+sqlite3 *get_index_db(sqlite3 *db);
+void set_index_db(sqlite3 *db, sqlite3 *mdb);
+void set_tracing(int on);
+int close_db(sqlite3 *db);
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+#ifndef EXPORT_H
+#define EXPORT_H
+#include "export.h"
+#endif
+
+#ifndef PROJECT_H
+#define PROJECT_H
+#include "project.h"
+#endif
+
+#ifndef TASK_UTILS_H
+#define TASK_UTILS_H
+#include "task_utils.h"
+#endif
+
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+// put_csv() writes a CSV field, quoting it only if it needs to be
+static void put_csv(const char *s, FILE *out){
+    const char *p;
+
+    if (s == NULL){
+        return;
+    }
+    if (strpbrk(s, ",\"\r\n") == NULL){
+        fputs(s, out);
+        return;
+    }
+    putc('"', out);
+    while ((p = strchr(s, '"')) != NULL){
+        fwrite(s, 1, p-s+1, out);
+        putc('"', out);
+        s = p+1;
+    }
+    fputs(s, out);
+    putc('"', out);
+}
+
+// put_json() writes a JSON string, or null. Runs of characters which need no
+// escaping are written in one go.
+static void put_json(const char *s, FILE *out){
+    const unsigned char *p;
+    const unsigned char *run;
+
+    if (s == NULL){
+        fputs("null", out);
+        return;
+    }
+    putc('"', out);
+    for (run = p = (const unsigned char*)s; *p != '\0'; p++){
+        if (*p >= 0x20 && *p != '"' && *p != '\\'){
+            continue;
+        }
+        fwrite(run, 1, p-run, out);
+        switch (*p){
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default: fprintf(out, "\\u%04x", *p); break;
+        }
+        run = p+1;
+    }
+    fwrite(run, 1, p-run, out);
+    putc('"', out);
+}
+
+// export_header() writes the header row of the export, if the format has one
+int export_header(EXPORT_FORMAT format, FILE *out){
+    if (format == EXPORT_CSV){
+        fputs("project,id,name,description,timestamp\n", out);
+    }
+    return 0;
+}
+
+// put_row() writes one exported row. The timestamp is left empty if has_ts is 0.
+static void put_row(char *project, long long id, const char *name, const char *desc,
+                    int has_ts, long long ts, EXPORT_FORMAT format, FILE *out){
+    if (format == EXPORT_CSV){
+        put_csv(project, out);
+        fprintf(out, ",%lld,", id);
+        put_csv(name, out);
+        putc(',', out);
+        put_csv(desc, out);
+        putc(',', out);
+        if (has_ts){
+            fprintf(out, "%lld", ts);
+        }
+        putc('\n', out);
+    } else{
+        fputs("{\"project\":", out);
+        put_json(project, out);
+        fprintf(out, ",\"id\":%lld,\"name\":", id);
+        put_json(name, out);
+        fputs(",\"description\":", out);
+        put_json(desc, out);
+        if (has_ts){
+            fprintf(out, ",\"timestamp\":%lld}\n", ts);
+        } else{
+            fputs(",\"timestamp\":null}\n", out);
+        }
+    }
+}
+
+// export_project() writes one row per timestamp of every task in the project,
+// and one row without a timestamp for each task which has none. Each finished
+// session gives a row for its start and one for its end, and a session still
+// open gives a row for its start, which qlock import opens again as the odd
+// last stamp of its task. Rows are written as they are stepped, in id and then
+// time order, so nothing is held in memory. The rows of one project can be
+// read back in by qlock import.
+// Returns the number of rows written, or -1 on error.
+int export_project(sqlite3 *db, char *project, EXPORT_FORMAT format, FILE *out){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    const char *name, *desc;
+    long long id;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(db, STMT_EXPORT_ROWS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        id = sqlite3_column_int64(stmt, 0);
+        name = (const char*)sqlite3_column_text(stmt, 1);
+        desc = (const char*)sqlite3_column_text(stmt, 2);
+        put_row(project, id, name, desc, sqlite3_column_type(stmt, 3) != SQLITE_NULL,
+                sqlite3_column_int64(stmt, 3), format, out);
+        n++;
+        if (sqlite3_column_type(stmt, 4) != SQLITE_NULL){
+            put_row(project, id, name, desc, 1, sqlite3_column_int64(stmt, 4), format, out);
+            n++;
+        }
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    return n;
+}
+
+// export_job holds the output of export_all_projects() for export_one()
+struct export_job{
+    EXPORT_FORMAT format;
+    FILE *out;
+    int total;
+};
+
+// export_project_file() exports the project name from its db file at path,
+// opened read-only and upgraded first if it is from an older qlock. Returns
+// the number of rows written, or -1 on error.
+int export_project_file(char *path, char *name, EXPORT_FORMAT format, FILE *out){
+    sqlite3 *db;
+    int e, n;
+
+    if ((e = open_project_file(path, &db, SQLITE_OPEN_READONLY)) != SQLITE_OK){
+        if (e == SQLITE_SCHEMA){
+            fprintf(stderr, "Could not upgrade project %s at path %s.\n", name, path);
+        } else{
+            fprintf(stderr, "Could not open project %s at path %s.\n", name, path);
+        }
+        return -1;
+    }
+    n = export_project(db, name, format, out);
+    close_db(db);
+    return n;
+}
+
+// export_one() exports a project visited by each_project(). A project without
+// a db file is skipped. Stops the listing on error, leaving the job's total
+// at -1.
+static int export_one(char *name, void *ctx){
+    struct export_job *job = ctx;
+    char *dbpath;
+    int n;
+
+    if ((dbpath = project_db_path(name)) == NULL){
+        job->total = -1;
+        return 1;
+    }
+    if (access(dbpath, F_OK) == -1){
+        free(dbpath);
+        return 0;
+    }
+    n = export_project_file(dbpath, name, job->format, job->out);
+    free(dbpath);
+    if (n < 0){
+        job->total = -1;
+        return 1;
+    }
+    job->total += n;
+    return 0;
+}
+
+// export_all_projects() exports every project listed in the master db, one
+// after the other, as the master db is read. Returns the number of rows
+// written, or -1 on error, including a project which could not be exported.
+int export_all_projects(sqlite3 *mdb, EXPORT_FORMAT format, FILE *out){
+    struct export_job job = {format, out, 0};
+
+    if (each_project(mdb, export_one, &job) < 0 || job.total < 0){
+        return -1;
+    }
+    return job.total;
+}
@@ -0,0 +1,9 @@
+#include <stdio.h>
+#include <sqlite3.h>
+
+typedef enum {EXPORT_CSV, EXPORT_NDJSON} EXPORT_FORMAT;
+
+int export_header(EXPORT_FORMAT format, FILE *out);
+int export_project(sqlite3 *db, char *project, EXPORT_FORMAT format, FILE *out);
+int export_project_file(char *path, char *name, EXPORT_FORMAT format, FILE *out);
+int export_all_projects(sqlite3 *mdb, EXPORT_FORMAT format, FILE *out);
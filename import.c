@@ -0,0 +1,743 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#ifndef IMPORT_H
+#define IMPORT_H
+#include "import.h"
+#endif
+
+#ifndef TASK_UTILS_H
+#define TASK_UTILS_H
+#include "task_utils.h"
+#endif
+
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef TASKS_H
+#define TASKS_H
+#include "tasks.h"
+#endif
+
+#define READ_BUF_SZ 65536
+#define MAX_CSV_FIELDS 16
+
+// Returned by the parsers when a buffer can't grow, as opposed to -1 for
+// malformed input
+#define IMPORT_NOMEM -2
+
+// Imported records are rows of (id, name, description, timestamp), the same
+// rows qlock export writes. A record without a timestamp only adds its task.
+// The project column of an export is checked, so that the tasks of several
+// projects, whose ids overlap, aren't merged into one.
+typedef enum {COL_ID, COL_NAME, COL_DESC, COL_TS, COL_PROJECT, NUM_COLS} IMPORT_COL;
+
+static const char *col_names[NUM_COLS] = {"id", "name", "description", "timestamp", "project"};
+
+// reader is a block buffered input stream
+struct reader{
+    FILE *f;
+    char buf[READ_BUF_SZ];
+    size_t pos;
+    size_t len;
+    long line;
+};
+
+// strbuf is a growable string which fields are parsed into
+struct strbuf{
+    char *s;
+    size_t len;
+    size_t cap;
+};
+
+// record holds the columns of a parsed row. A NULL column was not given.
+struct record{
+    size_t off[NUM_COLS];
+    int set[NUM_COLS];
+    char *col[NUM_COLS];
+};
+
+static int peek_char(struct reader *r){
+    if (r->pos == r->len){
+        r->len = fread(r->buf, 1, READ_BUF_SZ, r->f);
+        r->pos = 0;
+        if (r->len == 0){
+            return EOF;
+        }
+    }
+    return (unsigned char)r->buf[r->pos];
+}
+
+static int next_char(struct reader *r){
+    int c = peek_char(r);
+
+    if (c != EOF){
+        r->pos++;
+        if (c == '\n'){
+            r->line++;
+        }
+    }
+    return c;
+}
+
+// sb_putc() appends a character to b. Returns 0, or -1 if b could not grow,
+// in which case b is left as it was.
+static int sb_putc(struct strbuf *b, char c){
+    size_t cap;
+    char *tmp;
+
+    if (b->len+1 >= b->cap){
+        cap = (b->cap == 0) ? 256 : b->cap*2;
+        if ((tmp = realloc(b->s, cap)) == NULL){
+            return -1;
+        }
+        b->s = tmp;
+        b->cap = cap;
+    }
+    b->s[b->len++] = c;
+    b->s[b->len] = '\0';
+    return 0;
+}
+
+// finish_record() turns the field offsets of a record into pointers once the
+// buffer they point into is done growing
+static void finish_record(struct record *rec, struct strbuf *b){
+    for (int i = 0; i < NUM_COLS; i++){
+        rec->col[i] = rec->set[i] ? b->s + rec->off[i] : NULL;
+    }
+}
+
+// skip_bom() skips the UTF-8 byte order mark EF BB BF at the start of the
+// input, if there is one. Nothing is skipped unless all three bytes are
+// there, so input which merely starts with 0xEF is read as it is.
+static void skip_bom(struct reader *r){
+    if (peek_char(r) == EOF || r->len - r->pos < 3){
+        return;
+    }
+    if (memcmp(r->buf + r->pos, "\xEF\xBB\xBF", 3) == 0){
+        r->pos += 3;
+    }
+}
+
+// read_csv_fields() reads a single CSV record into b, storing the offset of
+// each field in off. Returns the number of fields, 0 at the end of the input,
+// -1 if a quoted field is never closed, or IMPORT_NOMEM.
+static int read_csv_fields(struct reader *r, struct strbuf *b, size_t *off){
+    int c;
+    int n = 0;
+    size_t start;
+
+    b->len = 0;
+    if (peek_char(r) == EOF){
+        return 0;
+    }
+    while (1){
+        start = b->len;
+        c = next_char(r);
+        if (c == '"'){
+            while (1){
+                c = next_char(r);
+                if (c == EOF){
+                    return -1;
+                }
+                if (c == '"'){
+                    if (peek_char(r) != '"'){
+                        break;
+                    }
+                    c = next_char(r);
+                }
+                if (sb_putc(b, c) != 0){
+                    return IMPORT_NOMEM;
+                }
+            }
+            c = next_char(r);
+            while (c != ',' && c != '\n' && c != EOF){
+                c = next_char(r);
+            }
+        } else{
+            while (c != ',' && c != '\n' && c != EOF){
+                if (sb_putc(b, c) != 0){
+                    return IMPORT_NOMEM;
+                }
+                c = next_char(r);
+            }
+            if (b->len > start && b->s[b->len-1] == '\r'){
+                b->s[--b->len] = '\0';
+            }
+        }
+        if (sb_putc(b, '\0') != 0){
+            return IMPORT_NOMEM;
+        }
+        if (n < MAX_CSV_FIELDS){
+            off[n] = start;
+        }
+        n++;
+        if (c != ','){
+            return n;
+        }
+    }
+}
+
+// put_utf8() appends a code point to b as UTF-8. Returns 0, or -1 if b could
+// not grow.
+static int put_utf8(struct strbuf *b, unsigned long cp){
+    char u[4];
+    int n;
+
+    if (cp < 0x80){
+        u[0] = cp;
+        n = 1;
+    } else if (cp < 0x800){
+        u[0] = 0xC0 | (cp >> 6);
+        u[1] = 0x80 | (cp & 0x3F);
+        n = 2;
+    } else if (cp < 0x10000){
+        u[0] = 0xE0 | (cp >> 12);
+        u[1] = 0x80 | ((cp >> 6) & 0x3F);
+        u[2] = 0x80 | (cp & 0x3F);
+        n = 3;
+    } else{
+        u[0] = 0xF0 | (cp >> 18);
+        u[1] = 0x80 | ((cp >> 12) & 0x3F);
+        u[2] = 0x80 | ((cp >> 6) & 0x3F);
+        u[3] = 0x80 | (cp & 0x3F);
+        n = 4;
+    }
+    for (int i = 0; i < n; i++){
+        if (sb_putc(b, u[i]) != 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// read_hex4() parses the four hex digits of a \u escape
+static long read_hex4(const char **p){
+    long v = 0;
+
+    for (int i = 0; i < 4; i++){
+        char c = *(*p)++;
+        v <<= 4;
+        if (c >= '0' && c <= '9'){
+            v |= c-'0';
+        } else if (c >= 'a' && c <= 'f'){
+            v |= c-'a'+10;
+        } else if (c >= 'A' && c <= 'F'){
+            v |= c-'A'+10;
+        } else{
+            return -1;
+        }
+    }
+    return v;
+}
+
+// parse_json_string() unescapes the JSON string starting after the opening
+// quote at *p into b. Returns -1 if the string is malformed, or IMPORT_NOMEM.
+static int parse_json_string(const char **p, struct strbuf *b){
+    long cp, lo;
+    char c;
+    int e;
+
+    while ((c = *(*p)++) != '"'){
+        if (c == '\0'){
+            return -1;
+        }
+        if (c != '\\'){
+            if (sb_putc(b, c) != 0){
+                return IMPORT_NOMEM;
+            }
+            continue;
+        }
+        switch (c = *(*p)++){
+            case '"': case '\\': case '/':
+                e = sb_putc(b, c);
+                break;
+            case 'b': e = sb_putc(b, '\b'); break;
+            case 'f': e = sb_putc(b, '\f'); break;
+            case 'n': e = sb_putc(b, '\n'); break;
+            case 'r': e = sb_putc(b, '\r'); break;
+            case 't': e = sb_putc(b, '\t'); break;
+            case 'u':
+                if ((cp = read_hex4(p)) < 0){
+                    return -1;
+                }
+                if (cp >= 0xD800 && cp < 0xDC00 && (*p)[0] == '\\' && (*p)[1] == 'u'){
+                    *p += 2;
+                    if ((lo = read_hex4(p)) < 0xDC00 || lo > 0xDFFF){
+                        return -1;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                e = put_utf8(b, cp);
+                break;
+            default:
+                return -1;
+        }
+        if (e != 0){
+            return IMPORT_NOMEM;
+        }
+    }
+    return 0;
+}
+
+static void skip_ws(const char **p){
+    while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n'){
+        (*p)++;
+    }
+}
+
+// parse_json_record() parses a flat JSON object into rec. String, number,
+// boolean and null values are accepted. Returns -1 if the line is not such an
+// object, or IMPORT_NOMEM.
+static int parse_json_record(const char *p, struct strbuf *b, struct record *rec){
+    struct strbuf key = {NULL, 0, 0};
+    int col, e;
+    size_t start;
+
+    b->len = 0;
+    memset(rec, 0, sizeof(struct record));
+    skip_ws(&p);
+    if (*p++ != '{'){
+        return -1;
+    }
+    skip_ws(&p);
+    if (*p == '}'){
+        return 0;
+    }
+    while (1){
+        skip_ws(&p);
+        key.len = 0;
+        if (key.s != NULL){
+            key.s[0] = '\0';
+        }
+        if (*p++ != '"'){
+            free(key.s);
+            return -1;
+        }
+        if ((e = parse_json_string(&p, &key)) != 0){
+            free(key.s);
+            return e;
+        }
+        col = -1;
+        for (int i = 0; i < NUM_COLS && key.s != NULL; i++){
+            if (strcmp(key.s, col_names[i]) == 0){
+                col = i;
+            }
+        }
+        skip_ws(&p);
+        if (*p++ != ':'){
+            free(key.s);
+            return -1;
+        }
+        skip_ws(&p);
+        start = b->len;
+        if (*p == '"'){
+            p++;
+            if ((e = parse_json_string(&p, b)) != 0){
+                free(key.s);
+                return e;
+            }
+        } else if (strncmp(p, "null", 4) == 0){
+            p += 4;
+            col = -1;
+        } else if (*p == '{' || *p == '['){
+            free(key.s);
+            return -1;
+        } else{
+            while (*p != ',' && *p != '}' && *p != '\0' && !strchr(" \t\r\n", *p)){
+                if (sb_putc(b, *p++) != 0){
+                    free(key.s);
+                    return IMPORT_NOMEM;
+                }
+            }
+        }
+        if (sb_putc(b, '\0') != 0){
+            free(key.s);
+            return IMPORT_NOMEM;
+        }
+        if (col >= 0){
+            rec->off[col] = start;
+            rec->set[col] = 1;
+        }
+        skip_ws(&p);
+        if (*p == ','){
+            p++;
+        } else if (*p == '}'){
+            break;
+        } else{
+            free(key.s);
+            return -1;
+        }
+    }
+    free(key.s);
+    return 0;
+}
+
+// read_line() reads the next line of input into b. Returns 1, 0 at the end of
+// the input, or IMPORT_NOMEM.
+static int read_line(struct reader *r, struct strbuf *b){
+    int c;
+
+    b->len = 0;
+    if (peek_char(r) == EOF){
+        return 0;
+    }
+    while ((c = next_char(r)) != '\n' && c != EOF){
+        if (sb_putc(b, c) != 0){
+            return IMPORT_NOMEM;
+        }
+    }
+    return 1;
+}
+
+// is_blank() returns 1 if a line has nothing but whitespace
+static int is_blank(const struct strbuf *b){
+    for (size_t i = 0; i < b->len; i++){
+        if (!strchr(" \t\r", b->s[i])){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// parse_int() parses a whole string as an integer
+static int parse_int(const char *s, long long *v){
+    char *end;
+
+    if (s == NULL || *s == '\0'){
+        return -1;
+    }
+    *v = strtoll(s, &end, 10);
+    return (*end == '\0') ? 0 : -1;
+}
+
+// check_project() checks that a record names the same project as every record
+// before it which named one, the first of which is copied into project.
+// Returns 0 if it does.
+static int check_project(struct record *rec, char **project){
+    const char *p = rec->col[COL_PROJECT];
+
+    if (p == NULL || *p == '\0'){
+        return 0;
+    }
+    if (*project == NULL){
+        if ((*project = malloc(strlen(p)+1)) == NULL){
+            return -1;
+        }
+        strcpy(*project, p);
+        return 0;
+    }
+    if (strcmp(p, *project) != 0){
+        fprintf(stderr, "Records of projects %s and %s can't be imported into one project.\n", *project, p);
+        return -1;
+    }
+    return 0;
+}
+
+// import_record() adds the task of a record if it is new, and its timestamp if
+// it has one
+static int import_record(sqlite3 *db, struct record *rec, long long *last_id, struct import_stats *st){
+    struct cached_stmt *cs;
+    long long id, ts;
+    int e;
+
+    if (parse_int(rec->col[COL_ID], &id) != 0){
+        fprintf(stderr, "Missing or invalid task id '%s'.\n", rec->col[COL_ID] ? rec->col[COL_ID] : "");
+        return -1;
+    }
+    // Rows of the same task usually come together, so only the first of them
+    // needs to try adding the task
+    if (id != *last_id && rec->col[COL_NAME] != NULL){
+        if ((cs = get_stmt(db, STMT_IMPORT_TASK)) == NULL){
+            return -1;
+        }
+        sqlite3_bind_int64(cs->stmt, cs->params[0], id);
+        sqlite3_bind_text(cs->stmt, cs->params[1], rec->col[COL_NAME], -1, SQLITE_STATIC);
+        if (rec->col[COL_DESC] != NULL){
+            sqlite3_bind_text(cs->stmt, cs->params[2], rec->col[COL_DESC], -1, SQLITE_STATIC);
+        }
+        if ((e = sqlite3_step(cs->stmt)) != SQLITE_DONE){
+            cleanup(e, cs->stmt, db);
+            return -1;
+        }
+        st->tasks += sqlite3_changes(db);
+        sqlite3_reset(cs->stmt);
+    }
+    *last_id = id;
+
+    if (rec->col[COL_TS] == NULL || rec->col[COL_TS][0] == '\0'){
+        return 0;
+    }
+    if (parse_int(rec->col[COL_TS], &ts) != 0){
+        fprintf(stderr, "Invalid timestamp '%s'.\n", rec->col[COL_TS]);
+        return -1;
+    }
+    if ((cs = get_stmt(db, STMT_IMPORT_STAMP)) == NULL){
+        return -1;
+    }
+    sqlite3_bind_int64(cs->stmt, cs->params[0], id);
+    sqlite3_bind_int64(cs->stmt, cs->params[1], ts);
+    if ((e = sqlite3_step(cs->stmt)) != SQLITE_DONE){
+        cleanup(e, cs->stmt, db);
+        return -1;
+    }
+    sqlite3_reset(cs->stmt);
+    st->stamps++;
+    return 0;
+}
+
+// begin_staging() creates the temporary table timestamps are read into, or
+// empties it if an earlier import on this connection left it behind
+static int begin_staging(sqlite3 *db){
+    int e;
+
+    if ((e = exec_stmt(db, STMT_IMPORT_STAGING)) != SQLITE_OK){
+        return e;
+    }
+    return exec_stmt(db, STMT_IMPORT_CLEAR);
+}
+
+// check_targets() checks every task which was given stamps by the import.
+// Each must exist and must not have been open before the import. Returns the
+// number of tasks which fail.
+static int check_targets(sqlite3 *db){
+    struct cached_stmt *cs;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(db, STMT_IMPORT_TARGETS)) == NULL){
+        return -1;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        if (sqlite3_column_int(cs->stmt, 1) == 0){
+            fprintf(stderr, "Task #%d does not exist.\n", sqlite3_column_int(cs->stmt, 0));
+        } else{
+            fprintf(stderr, "Task #%d is open, so stamps can't be imported into it.\n", sqlite3_column_int(cs->stmt, 0));
+        }
+        n++;
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, cs->stmt, db);
+        return -1;
+    }
+    return n;
+}
+
+// check_overlaps() checks the sessions the imported stamps pair up into
+// against the sessions their tasks already have, so that importing the same
+// records twice doesn't count their time twice. Returns the number of
+// imported sessions which overlap an existing one.
+static int check_overlaps(sqlite3 *db){
+    struct cached_stmt *cs;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(db, STMT_IMPORT_OVERLAPS)) == NULL){
+        return -1;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        if (sqlite3_column_type(cs->stmt, 2) == SQLITE_NULL){
+            fprintf(stderr, "Task #%d was given a session open since %lld, which overlaps one it already has.\n",
+                    sqlite3_column_int(cs->stmt, 0), (long long)sqlite3_column_int64(cs->stmt, 1));
+        } else{
+            fprintf(stderr, "Task #%d was given a session from %lld to %lld, which overlaps one it already has.\n",
+                    sqlite3_column_int(cs->stmt, 0), (long long)sqlite3_column_int64(cs->stmt, 1),
+                    (long long)sqlite3_column_int64(cs->stmt, 2));
+        }
+        n++;
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, cs->stmt, db);
+        return -1;
+    }
+    return n;
+}
+
+// add_sessions() adds the sessions the imported stamps pair up into, and
+// credits each finished one to the daily rollups of its task. The rest of the
+// rollups are left as they are. A task given an odd number of stamps is left
+// open from its last one, and the number of tasks left open is added to
+// opened. Returns SQLITE_OK or an SQLite error code.
+static int add_sessions(sqlite3 *db, int *opened){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    int e;
+
+    if ((cs = get_stmt(db, STMT_IMPORT_SESSIONS)) == NULL){
+        return SQLITE_ERROR;
+    }
+    stmt = cs->stmt;
+    // The insert is done in full on the first step, and the rows it returns
+    // are read back from memory, so the rollups can be written in between
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        if (sqlite3_column_type(stmt, 2) == SQLITE_NULL){
+            (*opened)++;
+            continue;
+        }
+        if ((e = credit_session(db, sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1),
+                                sqlite3_column_int64(stmt, 2))) != SQLITE_OK){
+            sqlite3_reset(stmt);
+            return e;
+        }
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return e;
+    }
+    return SQLITE_OK;
+}
+
+// import_tasks() reads task and timestamp records from in, as CSV with a
+// header row or as NDJSON, and adds them to the project. The format is told
+// apart by the first character of the input. The input is streamed, so memory
+// use does not depend on its size, and everything is added in one transaction
+// which is only committed if every record parses and every task's stamps pair
+// up without overlapping a session the task already has. Stamps are staged in
+// a temporary table and paired into sessions once all of them are read, so they
+// may arrive in any order, and an odd last stamp of a task clocks it in.
+// Records naming more than one project are refused. Returns 0 on success.
+int import_tasks(sqlite3 *db, FILE *in, struct import_stats *st){
+    struct reader *r;
+    struct strbuf b = {NULL, 0, 0};
+    struct strbuf text = {NULL, 0, 0};
+    struct record rec;
+    char *project = NULL;
+    size_t off[MAX_CSV_FIELDS];
+    int map[MAX_CSV_FIELDS];
+    long long last_id = -1;
+    int c, n, json;
+    int opened = 0;
+    int ret = 0;
+
+    st->tasks = 0;
+    st->stamps = 0;
+    if ((r = calloc(1, sizeof(struct reader))) == NULL){
+        return -1;
+    }
+    r->f = in;
+    r->line = 1;
+
+    // Skip a byte order mark and any leading whitespace to find the format
+    skip_bom(r);
+    while ((c = peek_char(r)) == ' ' || c == '\t' || c == '\r' || c == '\n'){
+        next_char(r);
+    }
+    json = (c == '{');
+
+    if (!json){
+        if ((n = read_csv_fields(r, &b, off)) <= 0){
+            if (n == IMPORT_NOMEM){
+                fprintf(stderr, "Out of memory reading the header row.\n");
+            } else{
+                fprintf(stderr, "The CSV input must start with a header row.\n");
+            }
+            free(r);
+            free(b.s);
+            return -1;
+        }
+        for (int i = 0; i < MAX_CSV_FIELDS; i++){
+            map[i] = -1;
+            for (int j = 0; j < NUM_COLS && i < n; j++){
+                if (strcmp(b.s + off[i], col_names[j]) == 0){
+                    map[i] = j;
+                }
+            }
+        }
+    }
+
+    if (begin_savepoint(db) != SQLITE_OK){
+        free(r);
+        free(b.s);
+        return -1;
+    }
+    if (begin_staging(db) != SQLITE_OK){
+        rollback_savepoint(db);
+        free(r);
+        free(b.s);
+        return -1;
+    }
+    while (ret == 0){
+        long line = r->line;
+
+        if (json){
+            if ((n = read_line(r, &text)) == 0){
+                break;
+            }
+            if (n != IMPORT_NOMEM && is_blank(&text)){
+                continue;
+            }
+            if (n == IMPORT_NOMEM || (n = parse_json_record(text.s, &b, &rec)) == IMPORT_NOMEM){
+                fprintf(stderr, "Line %ld: Out of memory reading the record.\n", line);
+                ret = -1;
+                break;
+            }
+            if (n != 0){
+                fprintf(stderr, "Line %ld: Not a flat JSON object.\n", line);
+                ret = -1;
+                break;
+            }
+        } else{
+            if ((n = read_csv_fields(r, &b, off)) == 0){
+                break;
+            }
+            if (n == IMPORT_NOMEM){
+                fprintf(stderr, "Line %ld: Out of memory reading the record.\n", line);
+                ret = -1;
+                break;
+            }
+            if (n < 0){
+                fprintf(stderr, "Line %ld: Unterminated quoted field.\n", line);
+                ret = -1;
+                break;
+            }
+            if (n == 1 && b.s[off[0]] == '\0'){
+                continue;
+            }
+            memset(&rec, 0, sizeof(struct record));
+            for (int i = 0; i < n && i < MAX_CSV_FIELDS; i++){
+                if (map[i] >= 0){
+                    rec.off[map[i]] = off[i];
+                    rec.set[map[i]] = 1;
+                }
+            }
+        }
+        finish_record(&rec, &b);
+        if (check_project(&rec, &project) != 0 || import_record(db, &rec, &last_id, st) != 0){
+            fprintf(stderr, "Line %ld: Could not import the record.\n", line);
+            ret = -1;
+        }
+    }
+    free(r);
+    free(b.s);
+    free(text.s);
+    free(project);
+
+    if (ret == 0 && check_targets(db) != 0){
+        ret = -1;
+    }
+    if (ret == 0 && check_overlaps(db) != 0){
+        ret = -1;
+    }
+    if (ret == 0 && add_sessions(db, &opened) != SQLITE_OK){
+        ret = -1;
+    }
+    exec_stmt(db, STMT_IMPORT_CLEAR);
+    if (ret != 0){
+        rollback_savepoint(db);
+        st->tasks = 0;
+        st->stamps = 0;
+        return ret;
+    }
+    if (release_savepoint(db) != SQLITE_OK){
+        return -1;
+    }
+    // Sessions left open are clocked in as far as the index is concerned
+    if (opened > 0 && sqlite3_get_autocommit(db) && sync_session_index(db) != SQLITE_OK){
+        fprintf(stderr, "Could not update the index of open sessions; run 'qlock reconcile' to rebuild it.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#include <stdio.h>
+#include <sqlite3.h>
+
+// import_stats counts what an import added to the project
+struct import_stats{
+    long tasks;
+    long stamps;
+};
+
+int import_tasks(sqlite3 *db, FILE *in, struct import_stats *st);
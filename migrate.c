@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <sqlite3.h>
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+#include "migrate.h"
+#endif
+
+#ifndef TASK_UTILS_H
+#define TASK_UTILS_H
+#include "task_utils.h"
+#endif
+
+// migration is a schema change, along with an optional function run after its
+// SQL in the same transaction to fill in data which SQL alone can't compute
+struct migration{
+    const char *sql;
+    int (*fn)(sqlite3 *db);
+};
+
+// Migrations are stored in the order they are applied. Migration i brings a
+// database from user_version i to i+1, so once a migration has been released it
+// must never be edited; schema changes are made by appending a new one and
+// bumping the version in migrate.h.
+static const struct migration project_migrations[PROJECT_DB_VERSION] = {
+    // 1: Base schema
+    {"CREATE TABLE IF NOT EXISTS task_info "
+     "(id INTEGER PRIMARY KEY, "
+     "name TEXT NOT NULL, "
+     "description TEXT);"
+     "CREATE TABLE IF NOT EXISTS task_ts "
+     "(id INTEGER NOT NULL, "
+     "timestamp INTEGER NOT NULL, "
+     "FOREIGN KEY(id) REFERENCES task_info(id));", NULL},
+    // 2: Covering index for per-task timestamp lookups
+    {"CREATE INDEX IF NOT EXISTS task_ts_id_timestamp ON task_ts (id, timestamp);", NULL},
+    // 3: Daily rollups of finished sessions. They are filled in by migration 4,
+    // since rebuild_rollups() reads the sessions table it creates.
+    {"CREATE TABLE IF NOT EXISTS task_daily "
+     "(task_id INTEGER NOT NULL, "
+     "day INTEGER NOT NULL, "
+     "seconds INTEGER NOT NULL, "
+     "PRIMARY KEY(task_id, day), "
+     "FOREIGN KEY(task_id) REFERENCES task_info(id)) WITHOUT ROWID;", NULL},
+    // 4: Sessions replace timestamps. Each task's stamps are paired up in time
+    // order, and a stamp left over at the end becomes its open session.
+    {"CREATE TABLE IF NOT EXISTS sessions "
+     "(task_id INTEGER NOT NULL, "
+     "start INTEGER NOT NULL, "
+     "end INTEGER, "
+     "FOREIGN KEY(task_id) REFERENCES task_info(id));"
+     "CREATE INDEX IF NOT EXISTS sessions_task_start ON sessions (task_id, start);"
+     "CREATE UNIQUE INDEX IF NOT EXISTS sessions_open ON sessions (task_id) WHERE end IS NULL;"
+     "INSERT INTO sessions (task_id, start, end) "
+     "SELECT id, timestamp, next FROM "
+     "(SELECT id, timestamp, LEAD(timestamp) OVER w AS next, ROW_NUMBER() OVER w AS n "
+     "FROM task_ts WINDOW w AS (PARTITION BY id ORDER BY timestamp, rowid)) "
+     "WHERE n%2=1;"
+     "DROP INDEX IF EXISTS task_ts_id_timestamp;"
+     "DROP TABLE task_ts;", rebuild_rollups},
+    // 5: Full-text index of task names and descriptions, kept up to date by
+    // triggers on task_info
+    {"CREATE VIRTUAL TABLE IF NOT EXISTS task_fts USING fts5"
+     "(name, description, content='task_info', content_rowid='id', prefix='2 3');"
+     "CREATE TRIGGER IF NOT EXISTS task_info_fts_insert AFTER INSERT ON task_info BEGIN "
+     "INSERT INTO task_fts (rowid, name, description) VALUES (new.id, new.name, new.description); "
+     "END;"
+     "CREATE TRIGGER IF NOT EXISTS task_info_fts_delete AFTER DELETE ON task_info BEGIN "
+     "INSERT INTO task_fts (task_fts, rowid, name, description) VALUES ('delete', old.id, old.name, old.description); "
+     "END;"
+     "CREATE TRIGGER IF NOT EXISTS task_info_fts_update AFTER UPDATE ON task_info BEGIN "
+     "INSERT INTO task_fts (task_fts, rowid, name, description) VALUES ('delete', old.id, old.name, old.description); "
+     "INSERT INTO task_fts (rowid, name, description) VALUES (new.id, new.name, new.description); "
+     "END;"
+     "INSERT INTO task_fts (task_fts) VALUES ('rebuild');", NULL},
+};
+
+static const struct migration master_migrations[MASTER_DB_VERSION] = {
+    // 1: Base schema
+    {"CREATE TABLE IF NOT EXISTS proj_info "
+     "(id INTEGER PRIMARY KEY, "
+     "name TEXT UNIQUE NOT NULL, "
+     "active INTEGER NOT NULL);", NULL},
+    // 2: Index of the sessions open in every project, kept up to date by the
+    // clock events of project connections with the master db attached. The
+    // project files may be older than this qlock, so they aren't read here:
+    // each project is indexed when it is next opened, or all at once by
+    // 'qlock reconcile', and marked indexed in proj_info.
+    {"CREATE TABLE IF NOT EXISTS open_sessions "
+     "(project TEXT NOT NULL, "
+     "task_id INTEGER NOT NULL, "
+     "started_at INTEGER NOT NULL, "
+     "PRIMARY KEY(project, task_id)) WITHOUT ROWID;"
+     "ALTER TABLE proj_info ADD COLUMN indexed INTEGER NOT NULL DEFAULT 0;", NULL},
+};
+
+// get_schema_version() returns the user_version of a database, or -1 on error
+int get_schema_version(sqlite3 *db){
+    sqlite3_stmt *stmt;
+    int e;
+    int v = -1;
+
+    e = sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL);
+    if (e != SQLITE_OK){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        return -1;
+    }
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        v = sqlite3_column_int(stmt, 0);
+    }
+    if (e != SQLITE_DONE){
+        fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
+        v = -1;
+    }
+    sqlite3_finalize(stmt);
+    return v;
+}
+
+// run_migrations() applies every migration past the current user_version of
+// the db. Each migration runs in its own transaction together with the version
+// bump, so an interrupted upgrade leaves the db at the last completed version.
+static int run_migrations(sqlite3 *db, const struct migration *migrations, int latest){
+    char *errmsg = NULL;
+    char version[48];
+    int e, v;
+
+    if ((v = get_schema_version(db)) < 0){
+        return SQLITE_ERROR;
+    }
+    if (v > latest){
+        fprintf(stderr, "Database schema version %d is newer than this qlock supports (%d).\n", v, latest);
+        return SQLITE_ERROR;
+    }
+    for (; v < latest; v++){
+        if ((e = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &errmsg)) != SQLITE_OK){
+            break;
+        }
+        if ((e = sqlite3_exec(db, migrations[v].sql, NULL, NULL, &errmsg)) != SQLITE_OK){
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            break;
+        }
+        if (migrations[v].fn != NULL && (e = (*migrations[v].fn)(db)) != SQLITE_OK){
+            // The fn sets no message of its own, and the rollback would
+            // replace the connection's, so it is kept first
+            errmsg = sqlite3_mprintf("%s", (sqlite3_errcode(db) != SQLITE_OK) ? sqlite3_errmsg(db) : sqlite3_errstr(e));
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            break;
+        }
+        sprintf(version, "PRAGMA user_version=%d;", v+1);
+        if ((e = sqlite3_exec(db, version, NULL, NULL, &errmsg)) != SQLITE_OK){
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            break;
+        }
+        if ((e = sqlite3_exec(db, "COMMIT;", NULL, NULL, &errmsg)) != SQLITE_OK){
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            break;
+        }
+    }
+    if (v < latest){
+        fprintf(stderr, "SQL error: Migration to version %d failed -- %s\n", v+1, errmsg ? errmsg : sqlite3_errmsg(db));
+        sqlite3_free(errmsg);
+        return e;
+    }
+    return SQLITE_OK;
+}
+
+// migrate_project_db() brings a project db up to the current schema
+int migrate_project_db(sqlite3 *db){
+    return run_migrations(db, project_migrations, PROJECT_DB_VERSION);
+}
+
+// migrate_master_db() brings the master db up to the current schema
+int migrate_master_db(sqlite3 *mdb){
+    return run_migrations(mdb, master_migrations, MASTER_DB_VERSION);
+}
@@ -0,0 +1,8 @@
+#include <sqlite3.h>
+
+#define PROJECT_DB_VERSION 5
+#define MASTER_DB_VERSION 2
+
+int get_schema_version(sqlite3 *db);
+int migrate_project_db(sqlite3 *db);
+int migrate_master_db(sqlite3 *mdb);
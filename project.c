@@ -1,8 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #ifndef PROJECT_H
 #define PROJECT_H
@@ -10,18 +13,32 @@
 #endif
 #include "task_utils.h"
 
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+#include "migrate.h"
+#endif
+
+#ifndef ARENA_H
+#define ARENA_H
+#include "arena.h"
+#endif
+
 // deactivate_projects() deactivates all projects before
 // adding a new project
 int deactivate_projects(sqlite3 *mdb){
-    char *zero_actives = "UPDATE proj_info SET active=0;";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
     int e;
 
-    e = sqlite3_prepare_v2(mdb, zero_actives, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
-        return e;
+    if ((cs = get_stmt(mdb, STMT_DEACTIVATE_PROJECTS)) == NULL){
+        return SQLITE_ERROR;
     }
+    stmt = cs->stmt;
     while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
     }
     if (e != SQLITE_DONE){
@@ -29,26 +46,23 @@ int deactivate_projects(sqlite3 *mdb){
         return e;
     }
 
-    sqlite3_finalize(stmt);
     return 0;
 }
 
 // project_exists() tests if a given project exists
 int project_exists(sqlite3 *mdb, char *name){
-    char *exists_query = "SELECT COUNT(*) FROM proj_info WHERE name=@name;";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i, l;
+    int e, l;
     int ret = 0;
     
     l = strlen(name);
 
-    e = sqlite3_prepare_v2(mdb, exists_query, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
-        return e;
+    if ((cs = get_stmt(mdb, STMT_PROJECT_EXISTS)) == NULL){
+        return SQLITE_ERROR;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@name");
-    e = sqlite3_bind_text(stmt, i, name, l, SQLITE_TRANSIENT);
+    stmt = cs->stmt;
+    e = sqlite3_bind_text(stmt, cs->params[0], name, l, SQLITE_TRANSIENT);
     if (e != SQLITE_OK){
         cleanup(e, stmt, mdb);
         return e;
@@ -60,16 +74,15 @@ int project_exists(sqlite3 *mdb, char *name){
         cleanup(e, stmt, mdb);
         return e;
     }
-    sqlite3_finalize(stmt);
     
     return ret;
 }
 
 // switch_active_project() switches the active project to the selected one
 int switch_active_project(sqlite3 *mdb, char *name){
-    char *activate_project = "UPDATE proj_info SET active=1 WHERE name=@name;";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i, l;
+    int e, l;
 
     if (!project_exists(mdb, name)){
         return -1;
@@ -79,14 +92,12 @@ int switch_active_project(sqlite3 *mdb, char *name){
         cleanup(e, NULL, mdb);
         return e;
     }
-    e = sqlite3_prepare_v2(mdb, activate_project, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
-        return e;
+    if ((cs = get_stmt(mdb, STMT_ACTIVATE_PROJECT)) == NULL){
+        return SQLITE_ERROR;
     }
+    stmt = cs->stmt;
     l = strlen(name);
-    i = sqlite3_bind_parameter_index(stmt, "@name");
-    e = sqlite3_bind_text(stmt, i, name, l, SQLITE_TRANSIENT);
+    e = sqlite3_bind_text(stmt, cs->params[0], name, l, SQLITE_TRANSIENT);
     if (e != SQLITE_OK){
         cleanup(e, stmt, mdb);
         return e;
@@ -97,31 +108,30 @@ int switch_active_project(sqlite3 *mdb, char *name){
         cleanup(e, stmt, mdb);
         return e;
     }
-    sqlite3_finalize(stmt);
     return 0;
 }
 
+// project_db_path() returns the malloc'd path of the db file of a project
+char *project_db_path(char *name){
+    char *dbpath = malloc(strlen(name)+4);
+
+    if (dbpath != NULL){
+        sprintf(dbpath, "%s.db", name);
+    }
+    return dbpath;
+}
+
 // create_project() creates a new project database
 int create_project(sqlite3 *db, sqlite3 *mdb, char* name){
     char *dbpath;
-    char *create_info_table = "CREATE TABLE IF NOT EXISTS task_info "
-                              "(id INTEGER PRIMARY KEY, "
-                              "name TEXT NOT NULL, "
-                              "description TEXT);";
-    char *create_ts_table = "CREATE TABLE IF NOT EXISTS task_ts "
-                            "(id INTEGER NOT NULL, "
-                            "timestamp INTEGER NOT NULL, "
-                            "FOREIGN KEY(id) REFERENCES task_info(id));";
-    char *insert_proj_into_mdb = "INSERT INTO proj_info (name, active) "
-                                 "VALUES (@name, 1);";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i, l;
+    int e, l;
 
     if (strlen(name) == 0){
         return -1;
     }
-    dbpath = malloc(sizeof(name)+3);
-    sprintf(dbpath, "%s.db", name);
+    dbpath = project_db_path(name);
     if (access(dbpath, F_OK) != -1){
         free(dbpath);
         return -2;
@@ -134,14 +144,12 @@ int create_project(sqlite3 *db, sqlite3 *mdb, char* name){
         free(dbpath);
         return e;
     }
-    e = sqlite3_prepare_v2(mdb, insert_proj_into_mdb, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
+    if ((cs = get_stmt(mdb, STMT_INSERT_PROJECT)) == NULL){
         free(dbpath);
-        return e;
+        return SQLITE_ERROR;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@name");
-    e = sqlite3_bind_text(stmt, i, name, l, SQLITE_TRANSIENT);
+    stmt = cs->stmt;
+    e = sqlite3_bind_text(stmt, cs->params[0], name, l, SQLITE_TRANSIENT);
     if (e != SQLITE_OK){
         cleanup(e, stmt, mdb);
         free(dbpath);
@@ -154,65 +162,39 @@ int create_project(sqlite3 *db, sqlite3 *mdb, char* name){
         free(dbpath);
         return e;
     }
-    sqlite3_finalize(stmt);
 
     // Create the project db file if everything went succesfully
-    if ((e = sqlite3_open(dbpath, &db)) != SQLITE_OK){
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        free(dbpath);
-        return e;
-    }
-
-    e = sqlite3_prepare_v2(db, create_info_table, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
-        free(dbpath);
-        return e;
-    }
-    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-    }
-    if (e != SQLITE_DONE){
-        cleanup(e, stmt, db);
+    if ((e = open_db(dbpath, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) != SQLITE_OK){
+        fprintf(stderr, "Can't open database: %s\n", sqlite3_errstr(e));
         free(dbpath);
         return e;
     }
-    sqlite3_finalize(stmt);
 
-    e = sqlite3_prepare_v2(db, create_ts_table, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
-        free(dbpath);
-        return e;
-    }
-    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-    }
-    if (e != SQLITE_DONE){
-        cleanup(e, stmt, db);
-        free(dbpath);
-        return e;
-    }
-    sqlite3_finalize(stmt);
+    e = migrate_project_db(db);
+    close_db(db);
     free(dbpath);
 
-    return 0;
+    return e;
 }
 
-// get_active_project_name() provides the currently active project name
+// get_active_project_name() returns the malloc'd name of the currently active
+// project, or NULL if there is none or it could not be read
 char *get_active_project_name(sqlite3 *mdb){
-    char *zero_actives = "SELECT name FROM proj_info WHERE active=1;";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
     int e, n;
     char *name;
 
-    e = sqlite3_prepare_v2(mdb, zero_actives, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
-        return "";
+    if ((cs = get_stmt(mdb, STMT_ACTIVE_PROJECT)) == NULL){
+        return NULL;
+    }
+    stmt = cs->stmt;
+    if ((e = sqlite3_step(stmt)) == SQLITE_DONE){
+        return NULL;
     }
-    if ((e = sqlite3_step(stmt)) != SQLITE_ROW){
+    if (e != SQLITE_ROW){
         cleanup(e, stmt, mdb);
-        return "";
+        return NULL;
     }
     sqlite3_column_text(stmt, 0);
     n = sqlite3_column_bytes(stmt, 0);
@@ -221,85 +203,355 @@ char *get_active_project_name(sqlite3 *mdb){
     if ((e = sqlite3_step(stmt)) != SQLITE_DONE){
         cleanup(e, stmt, mdb);
         free(name);
-        return "";
+        return NULL;
     }
 
-    sqlite3_finalize(stmt);
     return name;
 }
 
-// get_all_projects() returns the names of the currently active projects
-int get_all_projects(sqlite3 *mdb, char ***o){
+// each_project() steps through the names of every project and passes each to
+// cb as it is read. The name belongs to SQLite and is only valid until cb
+// returns. If cb returns nonzero the listing stops early. cb must not list
+// projects itself. Returns the number of projects passed to cb, or -1 on
+// error.
+int each_project(sqlite3 *mdb, int (*cb)(char *name, void *ctx), void *ctx){
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, l;
-    char *get_projects = "SELECT name FROM proj_info;";
-    char *get_project_len = "SELECT COUNT(*) FROM proj_info;";
+    int e;
     int n = 0;
 
-    e = sqlite3_prepare_v2(mdb, get_project_len, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
+    if ((cs = get_stmt(mdb, STMT_ALL_PROJECTS)) == NULL){
         return -1;
     }
+    stmt = cs->stmt;
     while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-        n = sqlite3_column_int(stmt, 0);
+        n++;
+        if ((*cb)((char*)sqlite3_column_text(stmt, 0), ctx) != 0){
+            sqlite3_reset(stmt);
+            return n;
+        }
     }
     if (e != SQLITE_DONE){
         cleanup(e, stmt, mdb);
         return -1;
     }
-    sqlite3_finalize(stmt);
+    return n;
+}
 
-    if (n > 0){
-        *o = malloc(n*sizeof(char*));
-    } else{
-        return 0;
+// name_collector builds an array of project names in an arena as
+// each_project() visits them
+struct name_collector{
+    struct arena *a;
+    char **names;
+    int n;
+    int cap;
+    int failed;
+};
+
+// collect_name() copies a visited project name into the collector's arena
+static int collect_name(char *name, void *ctx){
+    struct name_collector *c = ctx;
+    char **tmp;
+
+    if (c->n == c->cap){
+        c->cap = (c->cap == 0) ? 16 : c->cap*2;
+        if ((tmp = arena_grow(c->a, c->names, c->n*sizeof(char*), c->cap*sizeof(char*))) == NULL){
+            c->failed = 1;
+            return 1;
+        }
+        c->names = tmp;
+    }
+    if ((c->names[c->n] = arena_strndup(c->a, name, strlen(name))) == NULL){
+        c->failed = 1;
+        return 1;
+    }
+    c->n++;
+    return 0;
+}
+
+// get_all_projects() builds an array of the names of every project in the
+// arena and returns the length of the array
+int get_all_projects(sqlite3 *mdb, struct arena *a, char ***o){
+    struct name_collector c = {a, NULL, 0, 0, 0};
+
+    if (each_project(mdb, collect_name, &c) < 0 || c.failed){
+        return -1;
     }
+    *o = c.names;
+    return c.n;
+}
+
+// open_project_file() opens the project db at path, which must exist, for a
+// command that reads every project. A project not opened since qlock was
+// upgraded is still at an older schema, so it is upgraded first, the same as
+// opening it as the active project would. The db is opened with flags, which
+// should be read-only, along with any more it passes.
+// Returns SQLITE_OK, SQLITE_SCHEMA if the db is at an older schema and could
+// not be upgraded, or the error which kept it from being opened.
+int open_project_file(char *path, sqlite3 **db, int flags){
+    sqlite3 *w;
+    int e, v;
 
-    e = sqlite3_prepare_v2(mdb, get_projects, -1, &stmt, NULL);
+    if ((e = open_db(path, db, flags)) != SQLITE_OK){
+        return e;
+    }
+    if ((v = get_schema_version(*db)) >= PROJECT_DB_VERSION){
+        return SQLITE_OK;
+    }
+    close_db(*db);
+    *db = NULL;
+    if (v < 0){
+        return SQLITE_ERROR;
+    }
+    if (open_db(path, &w, SQLITE_OPEN_READWRITE | (flags & SQLITE_OPEN_NOMUTEX)) != SQLITE_OK){
+        return SQLITE_SCHEMA;
+    }
+    e = migrate_project_db(w);
+    close_db(w);
     if (e != SQLITE_OK){
-        cleanup(e, stmt, mdb);
+        return SQLITE_SCHEMA;
+    }
+    return open_db(path, db, flags);
+}
+
+// index_project_file() adds the open sessions of project name to the master
+// db's index, reading them from its db file with a connection of its own.
+// Returns the number of sessions added, or -1 on error.
+static int index_project_file(sqlite3 *mdb, char *name, struct arena *a){
+    struct cached_stmt *cs;
+    struct open_total *o;
+    sqlite3 *db;
+    char *path;
+    int e, n;
+
+    if ((path = project_db_path(name)) == NULL){
         return -1;
     }
-    int i = 0;
+    if (access(path, F_OK) == -1){
+        free(path);
+        return 0;
+    }
+    e = open_project_file(path, &db, SQLITE_OPEN_READONLY);
+    free(path);
+    if (e != SQLITE_OK){
+        return -1;
+    }
+    n = get_open_totals(db, a, &o);
+    close_db(db);
+    for (int i = 0; i < n; i++){
+        if ((cs = get_stmt(mdb, STMT_ADD_OPEN_SESSION)) == NULL){
+            return -1;
+        }
+        sqlite3_bind_text(cs->stmt, cs->params[0], name, -1, SQLITE_STATIC);
+        sqlite3_bind_int(cs->stmt, cs->params[1], o[i].id);
+        sqlite3_bind_int64(cs->stmt, cs->params[2], o[i].start);
+        while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        }
+        if (e != SQLITE_DONE){
+            cleanup(e, cs->stmt, mdb);
+            return -1;
+        }
+    }
+    return n;
+}
+
+// reconcile_open_sessions() rebuilds the master db's index of open sessions
+// from the project files, upgrading any which are older than this qlock. It
+// is the way to recover the index after a crash: a clock event commits to
+// its project db and then to the index, so a crash between the two leaves
+// the index out of step. A clock event which commits while this runs waits
+// to rewrite its project's entries until this is done, so none are lost.
+// Returns the number of open sessions indexed, or -1 on error.
+int reconcile_open_sessions(sqlite3 *mdb){
+    struct arena a = {NULL, 0};
+    char **names;
+    int n, m;
+    int total = 0;
+
+    if (begin_savepoint(mdb) != SQLITE_OK){
+        return -1;
+    }
+    if ((n = get_all_projects(mdb, &a, &names)) < 0 || exec_stmt(mdb, STMT_CLEAR_OPEN_SESSIONS) != SQLITE_OK){
+        total = -1;
+    }
+    for (int i = 0; i < n && total >= 0; i++){
+        m = index_project_file(mdb, names[i], &a);
+        total = (m < 0) ? -1 : total + m;
+    }
+    arena_free(&a);
+    if (total < 0 || exec_stmt(mdb, STMT_MARK_ALL_INDEXED) != SQLITE_OK){
+        rollback_savepoint(mdb);
+        return -1;
+    }
+    if (release_savepoint(mdb) != SQLITE_OK){
+        return -1;
+    }
+    return total;
+}
+
+// count_unindexed_projects() returns how many projects have yet to be added
+// to the index of open sessions since the master db was upgraded, or -1 on
+// error
+int count_unindexed_projects(sqlite3 *mdb){
+    struct cached_stmt *cs;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(mdb, STMT_UNINDEXED_PROJECTS)) == NULL){
+        return -1;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        n = sqlite3_column_int(cs->stmt, 0);
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, cs->stmt, mdb);
+        return -1;
+    }
+    return n;
+}
+
+// each_open_session() steps through the master db's index of open sessions
+// in project and then id order, passing each to cb as it is read. The project
+// name belongs to SQLite and is only valid until cb returns. If cb returns
+// nonzero the listing stops early. Returns the number of sessions passed to
+// cb, or -1 on error.
+int each_open_session(sqlite3 *mdb, int (*cb)(struct open_session *s, void *ctx), void *ctx){
+    struct cached_stmt *cs;
+    struct open_session s;
+    sqlite3_stmt *stmt;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(mdb, STMT_ALL_OPEN_SESSIONS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
     while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-        sqlite3_column_text(stmt, 0);
-        l = sqlite3_column_bytes(stmt, 0);
-        (*o)[i] = malloc(l*sizeof(char));
-        strcpy((*o)[i], (char*)sqlite3_column_text(stmt, 0));
-        i++;
+        n++;
+        s.project = (char*)sqlite3_column_text(stmt, 0);
+        s.id = sqlite3_column_int(stmt, 1);
+        s.start = sqlite3_column_int64(stmt, 2);
+        if ((*cb)(&s, ctx) != 0){
+            sqlite3_reset(stmt);
+            return n;
+        }
     }
     if (e != SQLITE_DONE){
         cleanup(e, stmt, mdb);
         return -1;
     }
-    sqlite3_finalize(stmt);
-
     return n;
 }
 
+// master_stamp() writes a stamp of the master db's files at mdb_path into buf,
+// which changes whenever the master db is written. A WAL write only touches
+// the -wal file until it is checkpointed, so an empty or missing -wal file is
+// left out, as it is when the last connection closes. Returns 0, or -1 if the
+// master db can't be read.
+static int master_stamp(char *mdb_path, char *buf, size_t sz){
+    struct stat db, wal;
+    char *wal_path;
+    int n;
+
+    if (stat(mdb_path, &db) != 0 || (wal_path = malloc(strlen(mdb_path)+5)) == NULL){
+        return -1;
+    }
+    sprintf(wal_path, "%s-wal", mdb_path);
+    if (stat(wal_path, &wal) != 0 || wal.st_size == 0){
+        memset(&wal, 0, sizeof(wal));
+    }
+    free(wal_path);
+    n = snprintf(buf, sz, "%lld.%09ld %lld %lld.%09ld %lld",
+                 (long long)db.st_mtim.tv_sec, db.st_mtim.tv_nsec, (long long)db.st_size,
+                 (long long)wal.st_mtim.tv_sec, wal.st_mtim.tv_nsec, (long long)wal.st_size);
+    return (n > 0 && (size_t)n < sz) ? 0 : -1;
+}
+
+// read_active_cache() returns the malloc'd project name kept in an active
+// project cache file, or NULL if the file is missing or empty. This lets the
+// active project be found without opening the master db. The name is only
+// given back if the master db at mdb_path is unchanged since it was cached,
+// so a switch the cache never saw can't leave it naming the wrong project.
+char *read_active_cache(char *path, char *mdb_path){
+    char buf[ACTIVE_CACHE_MAX_SZ];
+    char stamp[ACTIVE_CACHE_MAX_SZ];
+    char now[ACTIVE_CACHE_MAX_SZ];
+    char *name;
+    FILE *f;
+    size_t l;
+
+    if ((f = fopen(path, "r")) == NULL){
+        return NULL;
+    }
+    if (fgets(buf, sizeof(buf), f) == NULL || fgets(stamp, sizeof(stamp), f) == NULL){
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    stamp[strcspn(stamp, "\n")] = '\0';
+    if (master_stamp(mdb_path, now, sizeof(now)) != 0 || strcmp(stamp, now) != 0){
+        return NULL;
+    }
+    l = strcspn(buf, "\n");
+    if (l == 0){
+        return NULL;
+    }
+    if ((name = malloc(l+1)) != NULL){
+        memcpy(name, buf, l);
+        name[l] = '\0';
+    }
+    return name;
+}
+
+// write_active_cache() records the active project name in a cache file, along
+// with a stamp of the master db at mdb_path it was read from. The name is
+// written to a temporary file which is renamed over the cache, so readers
+// never see a partial name.
+int write_active_cache(char *path, char *name, char *mdb_path){
+    char stamp[ACTIVE_CACHE_MAX_SZ];
+    char *tmp;
+    FILE *f;
+    int e = 0;
+
+    if (master_stamp(mdb_path, stamp, sizeof(stamp)) != 0){
+        return -1;
+    }
+    if ((tmp = malloc(strlen(path)+24)) == NULL){
+        return -1;
+    }
+    sprintf(tmp, "%s.%ld", path, (long)getpid());
+    if ((f = fopen(tmp, "w")) == NULL){
+        free(tmp);
+        return -1;
+    }
+    if (fprintf(f, "%s\n%s\n", name, stamp) < 0){
+        e = -1;
+    }
+    if (fclose(f) != 0){
+        e = -1;
+    }
+    if (e == 0 && rename(tmp, path) != 0){
+        e = -1;
+    }
+    if (e != 0){
+        remove(tmp);
+    }
+    free(tmp);
+    return e;
+}
+
 // create_master_db() creates the master db of projects
 int create_master_db(sqlite3 **mdb, char *mdb_path){
-    char *create_info_table = "CREATE TABLE IF NOT EXISTS proj_info (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL, active INTEGER NOT NULL);";
     char *create_temp_table = "INSERT INTO proj_info (name, active) VALUES ('temp', 1);";
     sqlite3_stmt *stmt;
     int e;
 
-    if ((e = sqlite3_open(mdb_path, mdb)) != SQLITE_OK){
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(*mdb));
-        sqlite3_close(*mdb);
+    if ((e = open_db(mdb_path, mdb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) != SQLITE_OK){
+        fprintf(stderr, "Can't open database: %s\n", sqlite3_errstr(e));
         return e;
     }
 
-    e = sqlite3_prepare_v2(*mdb, create_info_table, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, *mdb);
-        return e;
-    }
-    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-    }
-    if (e != SQLITE_DONE){
-        cleanup(e, stmt, *mdb);
+    if ((e = migrate_master_db(*mdb)) != SQLITE_OK){
         return e;
     }
     e = sqlite3_prepare_v2(*mdb, create_temp_table, -1, &stmt, NULL);
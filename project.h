@@ -1,9 +1,29 @@
+#include <time.h>
 #include <sqlite3.h>
 
+#define ACTIVE_CACHE_MAX_SZ 256
+
+struct arena;
+
+// open_session is an entry of the master db's index of open sessions
+struct open_session{
+    char *project;
+    int id;
+    time_t start;
+};
+
 int deactivate_projects(sqlite3 *mdb);
 int project_exists(sqlite3 *mdb, char *name);
 int switch_active_project(sqlite3 *mdb, char* name);
+char *project_db_path(char *name);
 int create_project(sqlite3 *db, sqlite3 *mdb, char* name);
 char *get_active_project_name(sqlite3 *mdb);
-int get_all_projects(sqlite3 *mdb, char ***o);
+int each_project(sqlite3 *mdb, int (*cb)(char *name, void *ctx), void *ctx);
+int get_all_projects(sqlite3 *mdb, struct arena *a, char ***o);
+int open_project_file(char *path, sqlite3 **db, int flags);
+int reconcile_open_sessions(sqlite3 *mdb);
+int count_unindexed_projects(sqlite3 *mdb);
+int each_open_session(sqlite3 *mdb, int (*cb)(struct open_session *s, void *ctx), void *ctx);
 int create_master_db(sqlite3 **mdb, char *mdb_path);
+char *read_active_cache(char *path, char *mdb_path);
+int write_active_cache(char *path, char *name, char *mdb_path);
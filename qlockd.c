@@ -0,0 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sqlite3.h>
+
+#include "cli.h"
+#include "remote.h"
+
+// How long a client gets to send its whole request
+#define RECV_TIMEOUT_SEC 5
+
+static volatile sig_atomic_t stopping = 0;
+
+// on_stop() asks the accept loop to finish up
+static void on_stop(int sig){
+    stopping = 1;
+}
+
+// serve() runs one client's command with the client's stdin, stdout and
+// stderr standing in for our own, then puts ours back
+static int serve(struct qlock_ctx *ctx, struct remote_req *req, const int saved[3]){
+    int e;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++){
+        dup2(req->fds[i], i);
+        close(req->fds[i]);
+    }
+    clearerr(stdin);
+
+    ctx_refresh(ctx);
+    if (is_local_command(req->argc, req->argv)){
+        fprintf(stderr, "qlock %s must be run without qlockd.\n", req->argv[1]);
+        e = 1;
+    } else{
+        e = handle_input(ctx, req->argc, req->argv);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++){
+        dup2(saved[i], i);
+    }
+    clearerr(stdin);
+    return e;
+}
+
+int main(int argc, char **argv){
+    struct sigaction sa;
+    struct timeval tv = {RECV_TIMEOUT_SEC, 0};
+    struct remote_req req;
+    struct qlock_ctx ctx = {NULL, NULL, NULL, {NULL, 0}};
+    int saved[3];
+    int s, conn, e;
+
+    // stdin changes hands between commands so nothing may be read ahead of
+    // what a command asks for
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((s = remote_listen()) < 0){
+        return 1;
+    }
+    for (int i = 0; i < 3; i++){
+        saved[i] = dup(i);
+    }
+    fprintf(stderr, "qlockd listening on %s\n", QLOCKD_SOCK_PATH);
+
+    while (!stopping){
+        if ((conn = accept(s, NULL, NULL)) < 0){
+            if (errno != EINTR){
+                perror("accept");
+            }
+            continue;
+        }
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (remote_recv(conn, &req) == 0){
+            e = serve(&ctx, &req, saved);
+            remote_reply(conn, e);
+        }
+        close(conn);
+    }
+
+    close(s);
+    unlink(QLOCKD_SOCK_PATH);
+    close_ctx(&ctx);
+    return 0;
+}
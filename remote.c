@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef REMOTE_H
+#define REMOTE_H
+#include "remote.h"
+#endif
+
+// remote_hdr leads every request. The arguments follow it as NUL terminated
+// strings.
+struct remote_hdr{
+    int argc;
+    int len;
+};
+
+// sock_addr() fills in the address of the qlockd socket
+static void sock_addr(struct sockaddr_un *addr){
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, QLOCKD_SOCK_PATH, sizeof(addr->sun_path) - 1);
+}
+
+// write_all() writes all n bytes of buf to fd. Returns 0 on success.
+static int write_all(int fd, const void *buf, size_t n){
+    const char *p = buf;
+    ssize_t w;
+
+    while (n > 0){
+        if ((w = write(fd, p, n)) < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+// read_all() reads exactly n bytes from fd into buf. Returns 0 on success and
+// -1 on error or if the other end hangs up first.
+static int read_all(int fd, void *buf, size_t n){
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0){
+        if ((r = read(fd, p, n)) <= 0){
+            if (r < 0 && errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+// remote_call() runs a command on qlockd if it is listening. Returns the exit
+// status of the command, or -1 if there is no qlockd to run it (or QLOCK_DIRECT
+// is set) and the command should be run in this process instead.
+int remote_call(int argc, char **argv){
+    struct sockaddr_un addr;
+    struct remote_hdr hdr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union{
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    char args[MAX_REMOTE_ARGS_SZ];
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int conn;
+    int status;
+    size_t l;
+
+    if (getenv("QLOCK_DIRECT") != NULL || argc > MAX_REMOTE_ARGS){
+        return -1;
+    }
+    hdr.argc = argc;
+    hdr.len = 0;
+    for (int i = 0; i < argc; i++){
+        l = strlen(argv[i]) + 1;
+        if (hdr.len + l > MAX_REMOTE_ARGS_SZ){
+            return -1;
+        }
+        memcpy(args + hdr.len, argv[i], l);
+        hdr.len += l;
+    }
+
+    if ((conn = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        return -1;
+    }
+    sock_addr(&addr);
+    if (connect(conn, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        close(conn);
+        return -1;
+    }
+
+    // The descriptors ride along with the header so qlockd reads and writes
+    // the same terminal, pipes or files as this process
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(conn, &msg, 0) != sizeof(hdr) || write_all(conn, args, hdr.len) != 0){
+        close(conn);
+        return -1;
+    }
+
+    if (read_all(conn, &status, sizeof(status)) != 0){
+        fprintf(stderr, "Lost the connection to qlockd.\n");
+        status = 1;
+    }
+    close(conn);
+    return status;
+}
+
+// remote_listen() binds the qlockd socket. A socket file left behind by a
+// qlockd which is no longer running is replaced. Returns the listening socket,
+// or -1 if qlockd is already running or the socket could not be made.
+int remote_listen(void){
+    struct sockaddr_un addr;
+    int s;
+
+    sock_addr(&addr);
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        perror("socket");
+        return -1;
+    }
+    if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) == 0){
+        fprintf(stderr, "qlockd is already running on %s.\n", QLOCKD_SOCK_PATH);
+        close(s);
+        return -1;
+    }
+    close(s);
+    unlink(QLOCKD_SOCK_PATH);
+
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        perror("socket");
+        return -1;
+    }
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 16) != 0){
+        perror(QLOCKD_SOCK_PATH);
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// remote_recv() reads a request from a client connection. Returns 0 on
+// success, in which case the caller owns the descriptors in req->fds.
+int remote_recv(int conn, struct remote_req *req){
+    struct remote_hdr hdr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union{
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    ssize_t r;
+    int got_fds = 0;
+    char *p;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    while ((r = recvmsg(conn, &msg, 0)) < 0 && errno == EINTR){
+    }
+    if (r < 0){
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(req->fds))){
+            memcpy(req->fds, CMSG_DATA(cmsg), sizeof(req->fds));
+            got_fds = 1;
+        }
+    }
+    if (!got_fds){
+        return -1;
+    }
+    // Anything short of a whole request is refused, closing what was passed
+    if (r != sizeof(hdr) || hdr.argc < 2 || hdr.argc > MAX_REMOTE_ARGS
+        || hdr.len < 1 || hdr.len > MAX_REMOTE_ARGS_SZ
+        || read_all(conn, req->args, hdr.len) != 0 || req->args[hdr.len - 1] != '\0'){
+        for (int i = 0; i < 3; i++){
+            close(req->fds[i]);
+        }
+        return -1;
+    }
+
+    p = req->args;
+    req->argc = 0;
+    while (p < req->args + hdr.len && req->argc < hdr.argc){
+        req->argv[req->argc++] = p;
+        p += strlen(p) + 1;
+    }
+    req->argv[req->argc] = NULL;
+    // A command needs a name after the program's, and every argument the
+    // header promised
+    if (req->argc != hdr.argc){
+        for (int i = 0; i < 3; i++){
+            close(req->fds[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// remote_reply() sends the exit status of a command back to the client
+int remote_reply(int conn, int status){
+    return write_all(conn, &status, sizeof(status));
+}
@@ -0,0 +1,17 @@
+#define QLOCKD_SOCK_PATH "./.qlockd.sock"
+#define MAX_REMOTE_ARGS 64
+#define MAX_REMOTE_ARGS_SZ 4096
+
+// remote_req is a command handed to qlockd along with the client's stdin,
+// stdout and stderr
+struct remote_req{
+    int fds[3];
+    int argc;
+    char *argv[MAX_REMOTE_ARGS + 1];
+    char args[MAX_REMOTE_ARGS_SZ];
+};
+
+int remote_call(int argc, char **argv);
+int remote_listen(void);
+int remote_recv(int conn, struct remote_req *req);
+int remote_reply(int conn, int status);
@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#ifndef REPORT_H
+#define REPORT_H
+#include "report.h"
+#endif
+
+#ifndef TASK_UTILS_H
+#define TASK_UTILS_H
+#include "task_utils.h"
+#endif
+
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef PROJECT_H
+#define PROJECT_H
+#include "project.h"
+#endif
+
+#ifndef ARENA_H
+#define ARENA_H
+#include "arena.h"
+#endif
+
+// report_job is the work shared by the workers of a report. Work is handed
+// out chunk items at a time from next, so a worker which drew cheap items
+// comes back for more rather than sitting idle. The items are the tasks of a
+// project report, or the projects of a report on all of them.
+struct report_job{
+    char *path;
+    struct project_report *r;
+    struct all_report *all;
+    time_t now;
+    int count;
+    int chunk;
+    int next;
+    int failed;
+    pthread_mutex_t lock;
+};
+
+// report_worker is one thread of a report along with the arena it builds its
+// results in
+struct report_worker{
+    pthread_t thread;
+    struct report_job *job;
+    struct arena *arena;
+};
+
+// day_collector builds the array of days of one task in a worker's arena
+struct day_collector{
+    struct arena *a;
+    struct task_report *t;
+    int cap;
+    int failed;
+};
+
+// collect_day() adds a day of a task's breakdown to its report
+static int collect_day(struct day_elapsed *d, void *ctx){
+    struct day_collector *c = ctx;
+    struct task_report *t = c->t;
+    struct day_elapsed *tmp;
+
+    if (t->num_days == c->cap){
+        c->cap = (c->cap == 0) ? 8 : c->cap*2;
+        if ((tmp = arena_grow(c->a, t->days, t->num_days*sizeof(struct day_elapsed), c->cap*sizeof(struct day_elapsed))) == NULL){
+            c->failed = 1;
+            return 1;
+        }
+        t->days = tmp;
+    }
+    t->days[t->num_days++] = *d;
+    t->total += d->seconds;
+    return 0;
+}
+
+// claim_items() hands the next chunk of items to a worker, setting first to
+// the index of its first item. Returns the number of items in the chunk, which
+// is 0 once every item has been handed out or a worker has failed.
+static int claim_items(struct report_job *j, int *first){
+    int n = 0;
+
+    pthread_mutex_lock(&j->lock);
+    if (!j->failed && j->next < j->count){
+        *first = j->next;
+        n = j->count - j->next;
+        n = (n < j->chunk) ? n : j->chunk;
+        j->next += n;
+    }
+    pthread_mutex_unlock(&j->lock);
+    return n;
+}
+
+// fail_job() stops the other workers of a report from claiming more tasks
+static void fail_job(struct report_job *j){
+    pthread_mutex_lock(&j->lock);
+    j->failed = 1;
+    pthread_mutex_unlock(&j->lock);
+}
+
+// run_task_worker() is the body of a worker thread of a project report. It
+// opens a read-only connection of its own, without sqlite's mutexes as no
+// other thread uses it, and breaks down chunks of tasks until there are none
+// left. Each task's report is written in place, so the results come out in id
+// order without a merge.
+static void *run_task_worker(void *arg){
+    struct report_worker *w = arg;
+    struct report_job *j = w->job;
+    struct day_collector c = {w->arena, NULL, 0, 0};
+    sqlite3 *db;
+    int first, n;
+
+    if (open_db(j->path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX) != SQLITE_OK){
+        fail_job(j);
+        return NULL;
+    }
+    while ((n = claim_items(j, &first)) > 0){
+        for (int i = first; i < first + n; i++){
+            c.t = &j->r->tasks[i];
+            c.cap = 0;
+            if (get_elapsed_breakdown(db, c.t->id, collect_day, &c) != 0 || c.failed){
+                fail_job(j);
+                break;
+            }
+        }
+    }
+    close_db(db);
+    return NULL;
+}
+
+// list_tasks() fills the report with every task of the project at path, with
+// no time tracked yet. Returns the number of tasks, or -1 on error.
+static int list_tasks(char *path, struct project_report *r){
+    struct arena *a = &r->arenas[0];
+    struct task_row *rows;
+    sqlite3 *db;
+    int n;
+
+    if (open_db(path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX) != SQLITE_OK){
+        return -1;
+    }
+    n = get_all_tasks(db, a, &rows);
+    close_db(db);
+    if (n < 0 || (r->tasks = arena_alloc(a, (n ? n : 1)*sizeof(struct task_report))) == NULL){
+        return -1;
+    }
+    for (int i = 0; i < n; i++){
+        r->tasks[i].id = rows[i].id;
+        r->tasks[i].name = rows[i].name;
+        r->tasks[i].total = 0;
+        r->tasks[i].num_days = 0;
+        r->tasks[i].days = NULL;
+    }
+    r->num_tasks = n;
+    return n;
+}
+
+// alloc_arenas() sizes the pool of a report from the workers asked for,
+// where 0 or less means one per core, and allocates an arena for each worker
+// plus one for the listing the work is split from. Returns the number of
+// workers, or -1 on error.
+static int alloc_arenas(int workers, int *num_arenas, struct arena **arenas){
+    if (workers <= 0){
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    workers = (workers < 1) ? 1 : (workers > REPORT_MAX_WORKERS) ? REPORT_MAX_WORKERS : workers;
+    if ((*arenas = calloc(workers+1, sizeof(struct arena))) == NULL){
+        return -1;
+    }
+    *num_arenas = workers+1;
+    return workers;
+}
+
+// run_pool() runs up to workers threads of fn over the job, no more than
+// there are chunks of it, and waits for them all to finish. The job's
+// arenas[0] is left to the listing, so worker i builds in arenas[i+1].
+// Returns nonzero if any worker failed.
+static int run_pool(struct report_job *j, int workers, struct arena *arenas, void *(*fn)(void*)){
+    struct report_worker w[REPORT_MAX_WORKERS];
+    int chunks = (j->count + j->chunk - 1)/j->chunk;
+    int started;
+
+    workers = (chunks < workers) ? chunks : workers;
+    for (started = 0; started < workers; started++){
+        w[started].job = j;
+        w[started].arena = &arenas[started+1];
+        if (pthread_create(&w[started].thread, NULL, fn, &w[started]) != 0){
+            break;
+        }
+    }
+    // If no thread could be started the work is done here instead
+    if (started == 0 && workers > 0){
+        (*fn)(&w[0]);
+    }
+    for (int i = 0; i < started; i++){
+        pthread_join(w[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&j->lock);
+    return j->failed;
+}
+
+// report_project() breaks down the time tracked on every task of the project
+// db at path by day. The tasks are listed first, then split between a pool of
+// worker threads, each reading with its own connection. workers of 0 or less
+// uses one per core; no more are started than there are chunks of tasks.
+// Workers each read in a transaction of their own, so a clock event landing
+// mid-report may be seen by some tasks and not others.
+// Returns the number of tasks in the report, or -1 on error.
+int report_project(char *path, int workers, struct project_report *r){
+    struct report_job j = {path, r, NULL, 0, 0, REPORT_CHUNK, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+    memset(r, 0, sizeof(*r));
+    if ((workers = alloc_arenas(workers, &r->num_arenas, &r->arenas)) < 0){
+        return -1;
+    }
+    if (list_tasks(path, r) < 0){
+        report_free(r);
+        return -1;
+    }
+    j.count = r->num_tasks;
+    if (run_pool(&j, workers, r->arenas, run_task_worker) != 0){
+        report_free(r);
+        return -1;
+    }
+    return r->num_tasks;
+}
+
+// report_free() frees everything a report holds
+void report_free(struct project_report *r){
+    for (int i = 0; i < r->num_arenas; i++){
+        arena_free(&r->arenas[i]);
+    }
+    free(r->arenas);
+    memset(r, 0, sizeof(*r));
+}
+
+// sum_project() fills in the summary of a project from its db file, which a
+// project never clocked into may not have yet. A db file from before this
+// qlock is upgraded first, and left out of the report if it can't be.
+// Returns 0 on success.
+static int sum_project(struct project_summary *p, struct arena *a, time_t now){
+    sqlite3 *db;
+    char *path;
+    int n;
+
+    if ((path = project_db_path(p->name)) == NULL){
+        return -1;
+    }
+    if (access(path, F_OK) == -1){
+        free(path);
+        p->missing = 1;
+        return 0;
+    }
+    n = open_project_file(path, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+    free(path);
+    if (n == SQLITE_SCHEMA){
+        p->outdated = 1;
+        return 0;
+    }
+    if (n != SQLITE_OK){
+        return -1;
+    }
+    n = get_task_totals(db, a, now, &p->tasks);
+    close_db(db);
+    if (n < 0){
+        return -1;
+    }
+    p->num_tasks = n;
+    for (int i = 0; i < n; i++){
+        p->total += p->tasks[i].seconds;
+    }
+    return 0;
+}
+
+// run_project_worker() is the body of a worker thread of a report on every
+// project. Projects are claimed one at a time, each summed with a connection
+// opened for it alone, and written to their place in the listing.
+static void *run_project_worker(void *arg){
+    struct report_worker *w = arg;
+    struct report_job *j = w->job;
+    int first;
+
+    while (claim_items(j, &first) > 0){
+        if (sum_project(&j->all->projects[first], w->arena, j->now) != 0){
+            fail_job(j);
+            break;
+        }
+    }
+    return NULL;
+}
+
+// cmp_summary() orders project summaries by name
+static int cmp_summary(const void *a, const void *b){
+    return strcmp(((const struct project_summary*)a)->name, ((const struct project_summary*)b)->name);
+}
+
+// report_all() sums the time tracked on every task of every project listed in
+// the master db, with open sessions counted up to the same moment for all of
+// them. The projects are listed in name order first, then split between a
+// pool of worker threads as with report_project(). Projects without a db file
+// are kept in the report, marked missing, and ones which could not be
+// upgraded are kept marked outdated. Returns the number of projects in
+// the report, or -1 on error.
+int report_all(sqlite3 *mdb, int workers, struct all_report *r){
+    struct report_job j = {NULL, NULL, r, 0, 0, 1, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+    char **names;
+    int n;
+
+    memset(r, 0, sizeof(*r));
+    if ((workers = alloc_arenas(workers, &r->num_arenas, &r->arenas)) < 0){
+        return -1;
+    }
+    if ((n = get_all_projects(mdb, &r->arenas[0], &names)) < 0
+        || (r->projects = arena_alloc(&r->arenas[0], (n ? n : 1)*sizeof(struct project_summary))) == NULL){
+        all_report_free(r);
+        return -1;
+    }
+    memset(r->projects, 0, (n ? n : 1)*sizeof(struct project_summary));
+    for (int i = 0; i < n; i++){
+        r->projects[i].name = names[i];
+    }
+    qsort(r->projects, n, sizeof(struct project_summary), cmp_summary);
+    r->num_projects = n;
+    j.count = n;
+    j.now = time(NULL);
+    if (run_pool(&j, workers, r->arenas, run_project_worker) != 0){
+        all_report_free(r);
+        return -1;
+    }
+    for (int i = 0; i < n; i++){
+        r->total += r->projects[i].total;
+    }
+    return n;
+}
+
+// all_report_free() frees everything a report on every project holds
+void all_report_free(struct all_report *r){
+    for (int i = 0; i < r->num_arenas; i++){
+        arena_free(&r->arenas[i]);
+    }
+    free(r->arenas);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,58 @@
+#include <sqlite3.h>
+
+// Tasks are handed to workers this many at a time; projects are handed out
+// one at a time
+#define REPORT_CHUNK 64
+#define REPORT_MAX_WORKERS 16
+
+struct arena;
+struct day_elapsed;
+struct task_total;
+
+// task_report holds the time tracked on one task of a report, by day
+struct task_report{
+    int id;
+    char *name;
+    long long total;
+    int num_days;
+    struct day_elapsed *days;
+};
+
+// project_report holds the time tracked on every task of a project, in id
+// order. The tasks, their names and their days live in the report's arenas,
+// one per worker that built it, until report_free().
+struct project_report{
+    int num_tasks;
+    struct task_report *tasks;
+    int num_arenas;
+    struct arena *arenas;
+};
+
+// project_summary holds the total time tracked on each task of one project
+// of a report on every project. A project listed in the master db without a
+// db file of its own is missing and has no tasks, as is one whose db is at an
+// older schema and could not be upgraded, which is marked outdated.
+struct project_summary{
+    char *name;
+    int missing;
+    int outdated;
+    long long total;
+    int num_tasks;
+    struct task_total *tasks;
+};
+
+// all_report holds a summary of every project listed in the master db, in
+// name order, and the total of them all. As with project_report,
+// everything lives in the report's arenas until all_report_free().
+struct all_report{
+    int num_projects;
+    struct project_summary *projects;
+    long long total;
+    int num_arenas;
+    struct arena *arenas;
+};
+
+int report_project(char *path, int workers, struct project_report *r);
+void report_free(struct project_report *r);
+int report_all(sqlite3 *mdb, int workers, struct all_report *r);
+void all_report_free(struct all_report *r);
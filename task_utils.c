@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <sqlite3.h>
 #include <time.h>
 
@@ -9,25 +12,42 @@
 #include "task_utils.h"
 #endif
 
-// cleanup() frees the current statement and db and prints error messages in
-// the case of an error
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef ARENA_H
+#define ARENA_H
+#include "arena.h"
+#endif
+
+#ifndef DAYS_H
+#define DAYS_H
+#include "days.h"
+#endif
+
+// cleanup() releases the current statement and prints error messages in the
+// case of an error. The db is left open for its owner to close with close_db().
 void cleanup(int e, sqlite3_stmt *stmt, sqlite3 *db){
     fprintf(stderr, "SQL error: Error code %d -- %s\n", e, sqlite3_errmsg(db));
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    release_stmt(db, stmt);
 }
 
-// get_num_timestamps() returns the number of timestamps for a given task id.
-// This is primarily used to determine if a task is currently open or not.
+// get_num_timestamps() returns the number of timestamps for a given task id,
+// counting a start and an end for every finished session and a start for an
+// open one.
 int get_num_timestamps(sqlite3 *db, int id){
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i;
+    int e;
     int n = 0;
-    
-    char *statement = "SELECT COUNT(*) FROM task_ts WHERE id=@id;";
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-    i = sqlite3_bind_parameter_index(stmt, "@id");
-    sqlite3_bind_int(stmt, i, id);
+
+    if ((cs = get_stmt(db, STMT_NUM_TIMESTAMPS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    e = sqlite3_bind_int(stmt, cs->params[0], id);
     if (e != SQLITE_OK){
         cleanup(e, stmt, db);
         return -1;
@@ -39,25 +59,28 @@ int get_num_timestamps(sqlite3 *db, int id){
         cleanup(e, stmt, db);
         return -1;
     }
-    sqlite3_finalize(stmt);
     return n;
 }
 
 // task_is_open() returns 1 if the task is currently open
 int task_is_open(sqlite3 *db, int id){
-    return (get_num_timestamps(db, id) % 2 != 0);
+    time_t start;
+
+    return (get_open_session(db, id, &start) == 1);
 }
 
 // task_exists() returns 1 if a given task exists
 int task_exists(sqlite3 *db, int id){
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i;
+    int e;
     int n = 0;
 
-    char *statement = "SELECT COUNT(*) FROM task_info WHERE id=@id;";
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-    i = sqlite3_bind_parameter_index(stmt, "@id");
-    sqlite3_bind_int(stmt, i, id);
+    if ((cs = get_stmt(db, STMT_TASK_EXISTS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    e = sqlite3_bind_int(stmt, cs->params[0], id);
     if (e != SQLITE_OK){
         cleanup(e, stmt, db);
         return -1;
@@ -69,22 +92,20 @@ int task_exists(sqlite3 *db, int id){
         cleanup(e, stmt, db);
         return -1;
     }
-    sqlite3_finalize(stmt);
     return n;
 }
 
 // get_max_id() returns the max task id in task_info.
 int get_max_id(sqlite3 *db){
-    char *statement = "SELECT MAX(id) FROM task_info;";
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
     int e;
     int n = -1;
 
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
-        return e;
+    if ((cs = get_stmt(db, STMT_MAX_ID)) == NULL){
+        return -1;
     }
+    stmt = cs->stmt;
     while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
         n = sqlite3_column_int(stmt, 0);
     }
@@ -92,144 +113,704 @@ int get_max_id(sqlite3 *db){
         cleanup(e, stmt, db);
         return -1;
     }
-    sqlite3_finalize(stmt);
     return n;
 }
 
-// TODO: Have these also return the names of the tasks
-// get_open_tasks() builds an array of the currently open tasks and returns the
-// length of the array
-int get_open_tasks(sqlite3 *db, int **o){
+// each_task() steps through the tasks matching filter in id order and passes
+// each to cb as it is read, so a listing of any size is held in constant
+// memory. The strings of the row belong to SQLite and are only valid until cb
+// returns. If cb returns nonzero the listing stops early. cb must not list
+// tasks itself. Returns the number of tasks passed to cb, or -1 on error.
+int each_task(sqlite3 *db, TASK_FILTER filter, int (*cb)(struct task_row *t, void *ctx), void *ctx){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    struct task_row row;
+    const unsigned char *desc;
+    int e;
     int n = 0;
-    int i = 0;
 
-    for (int id = 0; id <= get_max_id(db); id++){
-        if (task_is_open(db, id)){
-            n++;
+    if ((cs = get_stmt(db, filter == TASKS_OPEN ? STMT_OPEN_TASKS : STMT_ALL_TASKS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        desc = sqlite3_column_text(stmt, 2);
+        row.id = sqlite3_column_int(stmt, 0);
+        row.name = (char*)sqlite3_column_text(stmt, 1);
+        row.desc = desc ? (char*)desc : "";
+        n++;
+        if ((*cb)(&row, ctx) != 0){
+            sqlite3_reset(stmt);
+            return n;
         }
     }
-    if (n > 0){
-        *o = malloc(sizeof(int)*n);
-        for (int id = 0; id <= get_max_id(db); id++){
-            if (task_is_open(db, id)){
-                (*o)[i] = id;
-                i++;
-            }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    return n;
+}
+
+// row_collector builds an array of task rows in an arena as each_task() visits
+// them
+struct row_collector{
+    struct arena *a;
+    struct task_row *rows;
+    int n;
+    int cap;
+    int failed;
+};
+
+// collect_row() copies a visited task row into the collector's arena
+static int collect_row(struct task_row *t, void *ctx){
+    struct row_collector *c = ctx;
+    struct task_row *tmp;
+
+    if (c->n == c->cap){
+        c->cap = (c->cap == 0) ? 8 : c->cap*2;
+        if ((tmp = arena_grow(c->a, c->rows, c->n*sizeof(struct task_row), c->cap*sizeof(struct task_row))) == NULL){
+            c->failed = 1;
+            return 1;
         }
+        c->rows = tmp;
+    }
+    c->rows[c->n].id = t->id;
+    c->rows[c->n].name = arena_strndup(c->a, t->name, strlen(t->name));
+    c->rows[c->n].desc = arena_strndup(c->a, t->desc, strlen(t->desc));
+    if (c->rows[c->n].name == NULL || c->rows[c->n].desc == NULL){
+        c->failed = 1;
+        return 1;
     }
+    c->n++;
+    return 0;
+}
 
-    return n;
+// collect_tasks() builds an array of the tasks matching filter in the arena,
+// returning the length of the array. The array and its strings share the
+// arena, so nothing is malloc'd per row.
+static int collect_tasks(sqlite3 *db, TASK_FILTER filter, struct arena *a, struct task_row **o){
+    struct row_collector c = {a, NULL, 0, 0, 0};
+
+    if (each_task(db, filter, collect_row, &c) < 0 || c.failed){
+        return -1;
+    }
+    *o = c.rows;
+    return c.n;
+}
+
+// get_open_tasks() builds an array of the currently open tasks and returns the
+// length of the array. Open sessions are the only rows in the partial
+// sessions_open index, so they are found without reading any finished ones.
+// The array lives in the arena until it is reset.
+int get_open_tasks(sqlite3 *db, struct arena *a, struct task_row **o){
+    return collect_tasks(db, TASKS_OPEN, a, o);
 }
 
-// TODO: Have these also return the names of the tasks
-// get_all_tasks() builds an array of all tasks and returns the length of the array
-int get_all_tasks(sqlite3 *db, int **o){
+// get_all_tasks() builds an array of all tasks in id order in the arena and
+// returns the length of the array
+int get_all_tasks(sqlite3 *db, struct arena *a, struct task_row **o){
+    return collect_tasks(db, TASKS_ALL, a, o);
+}
+
+// get_open_totals() builds an array in the arena of the open tasks in id
+// order, each with the seconds of its finished sessions taken from the daily
+// rollups and the start of its open session. Returns the length of the array,
+// or -1 on error.
+int get_open_totals(sqlite3 *db, struct arena *a, struct open_total **o){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    struct open_total *rows = NULL;
+    struct open_total *tmp;
+    const char *name;
+    int e;
     int n = 0;
-    int i = 0;
+    int cap = 0;
 
-    for (int id = 0; id <= get_max_id(db); id++){
-        if (task_exists(db, id)){
-            n++;
-        }
+    if ((cs = get_stmt(db, STMT_OPEN_TOTALS)) == NULL){
+        return -1;
     }
-    if (n > 0){
-        *o = malloc(sizeof(int)*n);
-        for (int id = 0; id <= get_max_id(db); id++){
-            if (task_exists(db, id)){
-                (*o)[i] = id;
-                i++;
+    stmt = cs->stmt;
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        if (n == cap){
+            cap = (cap == 0) ? 8 : cap*2;
+            if ((tmp = arena_grow(a, rows, n*sizeof(struct open_total), cap*sizeof(struct open_total))) == NULL){
+                sqlite3_reset(stmt);
+                return -1;
             }
+            rows = tmp;
+        }
+        name = (const char*)sqlite3_column_text(stmt, 1);
+        rows[n].id = sqlite3_column_int(stmt, 0);
+        rows[n].start = sqlite3_column_int64(stmt, 2);
+        rows[n].closed = sqlite3_column_int64(stmt, 3);
+        if ((rows[n].name = arena_strndup(a, name, sqlite3_column_bytes(stmt, 1))) == NULL){
+            sqlite3_reset(stmt);
+            return -1;
         }
+        n++;
     }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    *o = rows;
+    return n;
+}
+
+// get_task_totals() builds an array in the arena of every task in id order,
+// each with the seconds of its finished sessions taken from the daily rollups
+// plus those of an open session up to now, all in a single query. Returns the
+// length of the array, or -1 on error.
+int get_task_totals(sqlite3 *db, struct arena *a, time_t now, struct task_total **o){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    struct task_total *rows = NULL;
+    struct task_total *tmp;
+    const char *name;
+    time_t start;
+    int e;
+    int n = 0;
+    int cap = 0;
 
+    if ((cs = get_stmt(db, STMT_TASK_TOTALS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        if (n == cap){
+            cap = (cap == 0) ? 8 : cap*2;
+            if ((tmp = arena_grow(a, rows, n*sizeof(struct task_total), cap*sizeof(struct task_total))) == NULL){
+                sqlite3_reset(stmt);
+                return -1;
+            }
+            rows = tmp;
+        }
+        name = (const char*)sqlite3_column_text(stmt, 1);
+        rows[n].id = sqlite3_column_int(stmt, 0);
+        rows[n].seconds = sqlite3_column_int64(stmt, 2);
+        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL){
+            start = sqlite3_column_int64(stmt, 3);
+            rows[n].seconds += (now > start) ? now - start : 0;
+        }
+        if ((rows[n].name = arena_strndup(a, name, sqlite3_column_bytes(stmt, 1))) == NULL){
+            sqlite3_reset(stmt);
+            return -1;
+        }
+        n++;
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    *o = rows;
     return n;
 }
 
-// is_same_day() returns true if the two times occur on the same year, month, and day
-int is_same_day(struct tm a, struct tm b){
-    return ((a.tm_year == b.tm_year) &&
-            (a.tm_mon  == b.tm_mon)  &&
-            (a.tm_mday == b.tm_mday));
+// print_task() writes a visited task to the file in ctx
+static int print_task(struct task_row *t, void *ctx){
+    fprintf((FILE*)ctx, "%d\t%s\t%s\n", t->id, t->name, t->desc);
+    return 0;
+}
+
+// print_all_tasks() writes every task to out in id order as it is read,
+// without building an array first. Returns the number of tasks written.
+int print_all_tasks(sqlite3 *db, FILE *out){
+    return each_task(db, TASKS_ALL, print_task, out);
+}
+
+// put_fts_phrase() appends the l bytes of s to the buffer at p as an FTS5
+// phrase, quoted so that nothing in s is read as query syntax, and returns the
+// end of what was written
+static char *put_fts_phrase(char *p, const char *s, size_t l){
+    *p++ = '"';
+    for (size_t i = 0; i < l; i++){
+        if (s[i] == '"'){
+            *p++ = '"';
+        }
+        *p++ = s[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+// search_query() returns a malloc'd FTS5 query which matches every task
+// containing a word starting with each of the words of s. A word of l bytes
+// becomes at most 2l+4 (every byte a doubled quote, two quotes, the * and a
+// space), and takes at least l+1 bytes of s counting a separator, except for
+// the last, so 4 bytes per byte of s and 4 more cover the worst case.
+static char *search_query(const char *s){
+    char *q, *p;
+    size_t l;
+
+    if ((q = malloc(strlen(s)*4 + 4)) == NULL){
+        return NULL;
+    }
+    p = q;
+    while (*(s += strspn(s, " \t\n")) != '\0'){
+        l = strcspn(s, " \t\n");
+        if (p != q){
+            *p++ = ' ';
+        }
+        p = put_fts_phrase(p, s, l);
+        *p++ = '*';
+        s += l;
+    }
+    *p = '\0';
+    return q;
+}
+
+// search_tasks() passes the tasks matching query to cb, best match first. A
+// task matches if, for each word of the query, its name or description has a
+// word starting with it, and matches in the name rank above those in the
+// description. At most limit tasks are passed, and if cb returns nonzero the
+// search stops early. Returns the number of tasks passed to cb, or -1 on
+// error.
+int search_tasks(sqlite3 *db, char *query, int limit, int (*cb)(struct task_row *t, void *ctx), void *ctx){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    struct task_row row;
+    const unsigned char *desc;
+    char *q;
+    int e;
+    int n = 0;
+
+    if ((q = search_query(query)) == NULL){
+        return -1;
+    }
+    if (q[0] == '\0'){
+        free(q);
+        return 0;
+    }
+    if ((cs = get_stmt(db, STMT_SEARCH_TASKS)) == NULL){
+        free(q);
+        return -1;
+    }
+    stmt = cs->stmt;
+    sqlite3_bind_text(stmt, cs->params[0], q, -1, free);
+    sqlite3_bind_int(stmt, cs->params[1], limit);
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        desc = sqlite3_column_text(stmt, 2);
+        row.id = sqlite3_column_int(stmt, 0);
+        row.name = (char*)sqlite3_column_text(stmt, 1);
+        row.desc = desc ? (char*)desc : "";
+        n++;
+        if ((*cb)(&row, ctx) != 0){
+            sqlite3_reset(stmt);
+            return n;
+        }
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    return n;
 }
 
-// print_elapsed_breakdown() breaksdown the tracked time by day
-// TODO: Change this to return the values to be printed elsewhere
-int print_elapsed_breakdown(sqlite3 *db, int id){
-    char *statement = "SELECT * FROM task_ts WHERE id=@id;";
+// find_task() sets id to the task whose name starts with prefix, ignoring
+// case. A task named prefix exactly is picked over longer names. The index is
+// searched for names whose first words match prefix, and those are checked
+// with LIKE, since the index ignores punctuation. A prefix without any words
+// can't use the index, so it falls back to a scan of every name.
+// Returns 1 if one task matches, 0 if none do, -2 if several do and -1 on
+// error.
+int find_task(sqlite3 *db, char *prefix, int *id){
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    int e, i;
-    time_t rawtime;
-    struct tm *ltime;
-    int hr, min, sec;
-    int j = 0;
-    int elapsed = 0;
-    int total_elapsed = 0;
-    int num_ts = get_num_timestamps(db, id);
-    if (num_ts <= 0){
+    char *like, *q, *p;
+    size_t l = strlen(prefix);
+    int e;
+    int n = 0;
+    int exact = 0;
+    int words = 0;
+
+    if ((like = malloc(l*2 + 2)) == NULL){
         return -1;
     }
-    struct tm dates[num_ts];
-    int timestamps[num_ts];
+    p = like;
+    for (size_t i = 0; i < l; i++){
+        if (prefix[i] == '%' || prefix[i] == '_' || prefix[i] == '\\'){
+            *p++ = '\\';
+        }
+        words |= ((unsigned char)prefix[i] >= 0x80 || isalnum((unsigned char)prefix[i]));
+        *p++ = prefix[i];
+    }
+    *p++ = '%';
+    *p = '\0';
 
-    if (!task_exists(db, id)){
-        fprintf(stderr, "Task #%d does not exist.\n", id);
+    if (!words){
+        cs = get_stmt(db, STMT_FIND_TASK_SCAN);
+    } else if ((q = malloc(l*2 + 16)) == NULL){
+        free(like);
+        return -1;
+    } else{
+        p = q + sprintf(q, "name : ^ ");
+        p = put_fts_phrase(p, prefix, l);
+        strcpy(p, " *");
+        if ((cs = get_stmt(db, STMT_FIND_TASK)) != NULL){
+            sqlite3_bind_text(cs->stmt, cs->params[1], q, -1, free);
+        } else{
+            free(q);
+        }
+    }
+    if (cs == NULL){
+        free(like);
         return -1;
     }
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
+    stmt = cs->stmt;
+    sqlite3_bind_text(stmt, cs->params[0], prefix, l, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, cs->params[words ? 2 : 1], like, -1, free);
+    // Exact matches sort first, so a second row only makes the prefix
+    // ambiguous if the first isn't exact or both are
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        if (n++ == 0){
+            *id = sqlite3_column_int(stmt, 0);
+            exact = sqlite3_column_int(stmt, 1);
+        } else if (exact && !sqlite3_column_int(stmt, 1)){
+            n = 1;
+        }
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    return (n > 1) ? -2 : n;
+}
+
+// get_open_session() sets start to the start of the open session of task #id.
+// Returns 1 if the task has an open session, 0 if it doesn't, and -1 on error.
+int get_open_session(sqlite3 *db, int id, time_t *start){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    int e;
+    int n = 0;
+
+    if ((cs = get_stmt(db, STMT_OPEN_SESSION)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    e = sqlite3_bind_int(stmt, cs->params[0], id);
     if (e != SQLITE_OK){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        *start = sqlite3_column_int64(stmt, 0);
+        n = 1;
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return -1;
+    }
+    return n;
+}
+
+// day_key() returns the local day of a time as yyyymmdd
+int day_key(time_t t){
+    struct tm ltime;
+
+    localtime_r(&t, &ltime);
+    return (ltime.tm_year+1900)*10000 + (ltime.tm_mon+1)*100 + ltime.tm_mday;
+}
+
+// add_rollup() adds a number of seconds to the rollup of task #id on a day
+int add_rollup(sqlite3 *db, int id, int day, long long secs){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    int e;
+
+    if ((cs = get_stmt(db, STMT_ADD_ROLLUP)) == NULL){
+        return SQLITE_ERROR;
+    }
+    stmt = cs->stmt;
+    sqlite3_bind_int(stmt, cs->params[0], id);
+    sqlite3_bind_int(stmt, cs->params[1], day);
+    sqlite3_bind_int64(stmt, cs->params[2], secs);
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+    }
+    if (e != SQLITE_DONE){
         cleanup(e, stmt, db);
         return e;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@id");
-    e = sqlite3_bind_int(stmt, i, id);
-    if (e != SQLITE_OK){
+    return SQLITE_OK;
+}
+
+// rollup_acc sums the pieces of sessions split at midnight by task and day
+// before they are written to the rollups. id is the task the pieces being
+// added belong to.
+struct rollup_acc{
+    sqlite3 *db;
+    int id;
+    int cur_id;
+    int cur_day;
+    long long secs;
+    int e;
+};
+
+// flush_rollup() writes the day being summed to the rollups
+static int flush_rollup(struct rollup_acc *r){
+    int e = SQLITE_OK;
+
+    if (r->cur_id != -1){
+        e = add_rollup(r->db, r->cur_id, r->cur_day, r->secs);
+    }
+    r->cur_id = -1;
+    r->secs = 0;
+    return e;
+}
+
+// add_piece() adds the part of a session falling on one day to the sum,
+// writing out the previous day first if the task or day has changed
+static int add_piece(int key, long long secs, void *ctx){
+    struct rollup_acc *r = ctx;
+
+    if (r->id != r->cur_id || key != r->cur_day){
+        if ((r->e = flush_rollup(r)) != SQLITE_OK){
+            return 1;
+        }
+        r->cur_id = r->id;
+        r->cur_day = key;
+    }
+    r->secs += secs;
+    return 0;
+}
+
+// credit_session() adds a finished session of task #id to its daily rollups.
+// A session running past midnight is split, so each day is credited with only
+// the part of it which fell on that day.
+int credit_session(sqlite3 *db, int id, time_t start, time_t stop){
+    struct day_calendar cal = {NULL, NULL, 0, 0};
+    struct rollup_acc r = {db, id, -1, 0, 0, SQLITE_OK};
+    int e = calendar_split(&cal, start, stop, add_piece, &r);
+
+    calendar_free(&cal);
+    if (e != 0){
+        return (e < 0) ? SQLITE_ERROR : r.e;
+    }
+    return flush_rollup(&r);
+}
+
+// rebuild_rollups() regenerates the daily rollups of every task from its
+// finished sessions. This is needed after sessions are added or edited outside
+// of end_task(). Sessions are read in (task_id, start) order and split at
+// midnight, so the pieces of each task and day arrive together and are summed
+// before being written. The midnights are worked out once for the whole run
+// rather than with a localtime() call per session.
+int rebuild_rollups(sqlite3 *db){
+    struct day_calendar cal = {NULL, NULL, 0, 0};
+    struct rollup_acc r = {db, -1, -1, 0, 0, SQLITE_OK};
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    int e;
+    int split = 0;
+
+    if ((e = begin_savepoint(db)) != SQLITE_OK){
+        return e;
+    }
+    if ((e = exec_stmt(db, STMT_CLEAR_ROLLUPS)) != SQLITE_OK){
+        rollback_savepoint(db);
+        return e;
+    }
+    if ((cs = get_stmt(db, STMT_CLOSED_SESSIONS)) == NULL){
+        rollback_savepoint(db);
+        return SQLITE_ERROR;
+    }
+    stmt = cs->stmt;
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        r.id = sqlite3_column_int(stmt, 0);
+        split = calendar_split(&cal, sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 2), add_piece, &r);
+        if (split != 0){
+            e = (split < 0) ? SQLITE_ERROR : r.e;
+            break;
+        }
+    }
+    calendar_free(&cal);
+    if (e == SQLITE_DONE){
+        e = flush_rollup(&r);
+    } else if (split == 0){
         cleanup(e, stmt, db);
+    } else{
+        sqlite3_reset(stmt);
+    }
+    if (e != SQLITE_DONE && e != SQLITE_OK){
+        rollback_savepoint(db);
         return e;
     }
+    return release_savepoint(db);
+}
+
+// day_acc adds up the time of a breakdown by day and hands each day to the
+// breakdown's callback once the time added moves past it. Sessions are split
+// at midnight using its calendar.
+struct day_acc{
+    int key;
+    long long secs;
+    int stopped;
+    int (*cb)(struct day_elapsed *d, void *ctx);
+    void *ctx;
+    struct day_calendar cal;
+};
+
+// flush_day() passes the day being added up to the callback
+static void flush_day(struct day_acc *a){
+    struct day_elapsed day;
+
+    if (a->key == 0 || a->stopped){
+        return;
+    }
+    day.year = a->key/10000;
+    day.mon = (a->key/100)%100;
+    day.mday = a->key%100;
+    day.seconds = a->secs;
+    a->stopped = ((*a->cb)(&day, a->ctx) != 0);
+    a->key = 0;
+    a->secs = 0;
+}
+
+// add_day() adds a number of seconds to a day of the breakdown. Days must be
+// added in order, with the seconds of one day added together. Returns nonzero
+// once the callback has asked to stop.
+static int add_day(int key, long long secs, void *ctx){
+    struct day_acc *a = ctx;
+
+    if (key != a->key){
+        flush_day(a);
+        a->key = key;
+    }
+    a->secs += secs;
+    return a->stopped;
+}
+
+// add_span() credits the time from start to stop to the days it falls on.
+// Returns -1 on error.
+static int add_span(struct day_acc *a, time_t start, time_t stop){
+    if (stop <= start){
+        return 0;
+    }
+    return (calendar_split(&a->cal, start, stop, add_day, a) < 0) ? -1 : 0;
+}
+
+// get_elapsed_breakdown() breaks down the tracked time of task #id by day.
+// Finished sessions are read from the daily rollups, so the cost depends on the
+// number of days tracked rather than the number of stamps, and a session which
+// is still open is added on counting up to the current time, split at
+// midnight like the finished ones. Each day is passed to cb in order, and if
+// cb returns nonzero the breakdown stops early.
+// Returns 0 on success and -1 if the task does not exist or could not be read.
+int get_elapsed_breakdown(sqlite3 *db, int id, int (*cb)(struct day_elapsed *d, void *ctx), void *ctx){
+    struct day_acc acc = {0, 0, 0, cb, ctx, {NULL, NULL, 0, 0}};
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    time_t start = 0;
+    int e, open;
+
+    if (task_exists(db, id) != 1){
+        return -1;
+    }
+    if ((open = get_open_session(db, id, &start)) < 0){
+        return -1;
+    }
+    if ((cs = get_stmt(db, STMT_TASK_ROLLUPS)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    e = sqlite3_bind_int(stmt, cs->params[0], id);
+    if (e != SQLITE_OK){
+        cleanup(e, stmt, db);
+        return -1;
+    }
     while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
-        rawtime = sqlite3_column_int(stmt, 1);
-        ltime = localtime(&rawtime);
-        dates[j] = *ltime;
-        timestamps[j] = rawtime;
-        j++;
+        if (add_day(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), &acc) != 0){
+            sqlite3_reset(stmt);
+            return 0;
+        }
     }
     if (e != SQLITE_DONE){
         cleanup(e, stmt, db);
         return -1;
     }
-    sqlite3_finalize(stmt);
-    // If we didn't read any lines in, return
-    if (j == 0){
-        cleanup(1, NULL, db);
+    // The open session started after every finished one ended, so its days
+    // come after those read, apart from perhaps sharing the last one
+    e = (open == 1) ? add_span(&acc, start, time(NULL)) : 0;
+    calendar_free(&acc.cal);
+    if (e != 0){
         return -1;
     }
+    flush_day(&acc);
 
-    // FIXME: This will not accurately count if a task starts one day and runs through to the next day (ie. working over midnight)
-    int n = 0;
-    for (j = 0; j < num_ts; j++){
-        if ((is_same_day(dates[j+1], dates[j])) && (j != num_ts)){
-            if (n%2==0){
-                elapsed += timestamps[j+1]-timestamps[j];
-            }
-            n++;
-        } else{
-            if (n%2==0){
-                // Mod check seems backwards but it's because we skip incrementing n the last time
-                elapsed += time(NULL) - timestamps[j];
-            }
-            hr = elapsed/3600;
-            min = (elapsed-hr*3600)/60;
-            sec = elapsed-(hr*3600+min*60);
-            printf("%d-%d-%d: %02d:%02d:%02d\n", dates[j].tm_year+1900, dates[j].tm_mon+1, dates[j].tm_mday, hr, min, sec);
-            total_elapsed += elapsed;
-            elapsed = 0;
-            n = 0;
-        }
-    }
-    hr = total_elapsed/3600;
-    min = (total_elapsed-hr*3600)/60;
-    sec = total_elapsed-(hr*3600+min*60);
-    printf("-----------\nTotal: %02d:%02d:%02d\n", hr, min, sec);
+    return 0;
+}
+
+// session_end() returns the end of a session row's column col, clipped to
+// until. A session which is still open ends at the current time.
+static time_t session_end(sqlite3_stmt *stmt, int col, time_t until, time_t now){
+    time_t end = now;
+
+    if (sqlite3_column_type(stmt, col) != SQLITE_NULL){
+        end = sqlite3_column_int64(stmt, col);
+    }
+    return end < until ? end : until;
+}
+
+// get_elapsed_range() breaks down the time tracked on task #id from since up
+// to until by day, like get_elapsed_breakdown(). Only the sessions starting
+// inside the window are read, by a range seek on the (task_id, start) index,
+// along with the one session before it which may run into the window.
+// Sessions crossing either edge are clipped to it, and a session which is
+// still open counts up to the current time.
+// Returns 0 on success and -1 if the task does not exist or could not be read.
+int get_elapsed_range(sqlite3 *db, int id, time_t since, time_t until,
+                      int (*cb)(struct day_elapsed *d, void *ctx), void *ctx){
+    struct day_acc acc = {0, 0, 0, cb, ctx, {NULL, NULL, 0, 0}};
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    time_t now = time(NULL);
+    int e;
+    int err = 0;
+
+    if (task_exists(db, id) != 1){
+        return -1;
+    }
+    if (since >= until){
+        return 0;
+    }
+    if ((cs = get_stmt(db, STMT_SESSION_BEFORE)) == NULL){
+        return -1;
+    }
+    stmt = cs->stmt;
+    sqlite3_bind_int(stmt, cs->params[0], id);
+    sqlite3_bind_int64(stmt, cs->params[1], since);
+    while (err == 0 && (e = sqlite3_step(stmt)) == SQLITE_ROW){
+        err = add_span(&acc, since, session_end(stmt, 1, until, now));
+    }
+    if (err != 0){
+        sqlite3_reset(stmt);
+    } else if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        err = -1;
+    }
+
+    if (err == 0 && (cs = get_stmt(db, STMT_SESSIONS_BETWEEN)) == NULL){
+        err = -1;
+    } else if (err == 0){
+        stmt = cs->stmt;
+        sqlite3_bind_int(stmt, cs->params[0], id);
+        sqlite3_bind_int64(stmt, cs->params[1], since);
+        sqlite3_bind_int64(stmt, cs->params[2], until);
+        while (err == 0 && !acc.stopped && (e = sqlite3_step(stmt)) == SQLITE_ROW){
+            err = add_span(&acc, sqlite3_column_int64(stmt, 0), session_end(stmt, 1, until, now));
+        }
+        if (err != 0 || acc.stopped){
+            sqlite3_reset(stmt);
+        } else if (e != SQLITE_DONE){
+            cleanup(e, stmt, db);
+            err = -1;
+        }
+    }
+    calendar_free(&acc.cal);
+    if (err != 0){
+        return -1;
+    }
+    flush_day(&acc);
 
     return 0;
 }
@@ -1,10 +1,60 @@
+#include <stdio.h>
+#include <time.h>
 #include <sqlite3.h>
 
+struct arena;
+
+// task_row holds the listing information of a single task
+struct task_row{
+    int id;
+    char *name;
+    char *desc;
+};
+
+typedef enum {TASKS_ALL, TASKS_OPEN} TASK_FILTER;
+
+// open_total holds an open task with the time of its finished sessions and
+// the start of its open one, from which its running total can be worked out
+// at any time without another query
+struct open_total{
+    int id;
+    char *name;
+    time_t start;
+    long long closed;
+};
+
+// task_total holds the time tracked on a task up to some moment
+struct task_total{
+    int id;
+    char *name;
+    long long seconds;
+};
+
+// day_elapsed holds the time tracked on a task on a single local day
+struct day_elapsed{
+    int year;
+    int mon;
+    int mday;
+    int seconds;
+};
+
 void cleanup(int e, sqlite3_stmt *stmt, sqlite3 *db);
 int get_num_timestamps(sqlite3 *db, int id);
 int task_is_open(sqlite3 *db, int id);
 int task_exists(sqlite3 *db, int id);
 int get_max_id(sqlite3 *db);
-int get_open_tasks(sqlite3 *db, int **o);
-int get_all_tasks(sqlite3 *db, int **o);
-int print_elapsed_breakdown(sqlite3 *db, int id);
+int each_task(sqlite3 *db, TASK_FILTER filter, int (*cb)(struct task_row *t, void *ctx), void *ctx);
+int get_open_tasks(sqlite3 *db, struct arena *a, struct task_row **o);
+int search_tasks(sqlite3 *db, char *query, int limit, int (*cb)(struct task_row *t, void *ctx), void *ctx);
+int find_task(sqlite3 *db, char *prefix, int *id);
+int get_all_tasks(sqlite3 *db, struct arena *a, struct task_row **o);
+int get_open_totals(sqlite3 *db, struct arena *a, struct open_total **o);
+int get_task_totals(sqlite3 *db, struct arena *a, time_t now, struct task_total **o);
+int print_all_tasks(sqlite3 *db, FILE *out);
+int get_open_session(sqlite3 *db, int id, time_t *start);
+int day_key(time_t t);
+int add_rollup(sqlite3 *db, int id, int day, long long secs);
+int credit_session(sqlite3 *db, int id, time_t start, time_t stop);
+int rebuild_rollups(sqlite3 *db);
+int get_elapsed_breakdown(sqlite3 *db, int id, int (*cb)(struct day_elapsed *d, void *ctx), void *ctx);
+int get_elapsed_range(sqlite3 *db, int id, time_t since, time_t until, int (*cb)(struct day_elapsed *d, void *ctx), void *ctx);
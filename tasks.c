@@ -1,7 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <time.h>
+#include <unistd.h>
 
 #ifndef TASKS_H
 #define TASKS_H
@@ -13,36 +17,42 @@
 #include "task_utils.h"
 #endif
 
+#ifndef DB_H
+#define DB_H
+#include "db.h"
+#endif
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+#include "migrate.h"
+#endif
+
 // create_task() creates a new task with a generated id, no start or end time,
 // and a user-set name and description
 int create_task(sqlite3 *db, char *name, char *desc){
+    struct cached_stmt *cs;
     sqlite3_stmt *stmt;
-    char *statement = "INSERT INTO task_info (id, name, description) VALUES (@id, @name, @desc);";
-    int e, i, l, id;
+    int e, l, id;
 
     id = get_max_id(db) + 1;
 
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
+    if ((cs = get_stmt(db, STMT_INSERT_TASK)) == NULL){
         return -1;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@id");
-    e = sqlite3_bind_int(stmt, i, id);
+    stmt = cs->stmt;
+    e = sqlite3_bind_int(stmt, cs->params[0], id);
     if (e != SQLITE_OK){
         cleanup(e, stmt, db);
         return -1;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@name");
     l = strlen(name);
-    e = sqlite3_bind_text(stmt, i, name, l, SQLITE_TRANSIENT);
+    e = sqlite3_bind_text(stmt, cs->params[1], name, l, SQLITE_TRANSIENT);
     if (e != SQLITE_OK){
         cleanup(e, stmt, db);
         return -1;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@desc");
     l = strlen(desc);
-    e = sqlite3_bind_text(stmt, i, desc, l, SQLITE_TRANSIENT);
+    e = sqlite3_bind_text(stmt, cs->params[2], desc, l, SQLITE_TRANSIENT);
     if (e != SQLITE_OK){
         cleanup(e, stmt, db);
         return -1;
@@ -53,71 +63,295 @@ int create_task(sqlite3 *db, char *name, char *desc){
         cleanup(e, stmt, db);
         return -1;
     }
-    sqlite3_finalize(stmt);
     return id;
 }
 
-// stamp_task() adds a new timestamp for task #id into the task_ts table
-int stamp_task(sqlite3 *db, int id){
-    char *statement = "INSERT INTO task_ts (id, timestamp) VALUES (@id, @ts);";
-    sqlite3_stmt *stmt;
-    int e, i;
+// open_index_db() sets mdb to the connection's master db, opening it the
+// first time it is needed. The index isn't kept, and mdb is set to NULL, if
+// the connection names no master db, or names one which doesn't exist or is
+// too old to have the index. Returns SQLITE_OK or an SQLite error code.
+static int open_index_db(sqlite3 *db, sqlite3 **mdb){
+    const char *path = get_index_path(db);
+    int e;
 
-    e = sqlite3_prepare_v2(db, statement, -1, &stmt, NULL);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
+    if ((*mdb = get_index_db(db)) != NULL || path == NULL){
+        return SQLITE_OK;
+    }
+    if (access(path, F_OK) == -1){
+        return set_index_project(db, NULL, NULL) == 0 ? SQLITE_OK : SQLITE_NOMEM;
+    }
+    if ((e = open_db((char*)path, mdb, SQLITE_OPEN_READWRITE)) != SQLITE_OK){
         return e;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@id");
-    e = sqlite3_bind_int(stmt, i, id);
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
+    // The index can always be rebuilt from the project dbs, so its commits
+    // aren't synced to disk: the clock event's own commit is the only sync
+    sqlite3_exec(*mdb, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+    // Migration 2 of the master db adds the index
+    if (get_schema_version(*mdb) < 2){
+        close_db(*mdb);
+        *mdb = NULL;
+        return set_index_project(db, NULL, NULL) == 0 ? SQLITE_OK : SQLITE_NOMEM;
+    }
+    set_index_db(db, *mdb);
+    return SQLITE_OK;
+}
+
+// sync_session_index() rewrites the project's entries in the master db's index
+// of open sessions from its sessions table, if the connection keeps the index,
+// and marks the project indexed. The project's sessions are read inside the
+// master db's transaction, so of two processes clocking the same project the
+// last to write the index has read the latest sessions. Returns SQLITE_OK or
+// an SQLite error code.
+int sync_session_index(sqlite3 *db){
+    const char *project = get_index_project(db);
+    struct cached_stmt *cs;
+    struct cached_stmt *add;
+    sqlite3 *mdb;
+    int e;
+
+    if ((e = open_index_db(db, &mdb)) != SQLITE_OK || mdb == NULL){
         return e;
     }
-    i = sqlite3_bind_parameter_index(stmt, "@ts");
-    e = sqlite3_bind_int(stmt, i, time(NULL));
-    if (e != SQLITE_OK){
-        cleanup(e, stmt, db);
+    if ((e = begin_savepoint(mdb)) != SQLITE_OK){
         return e;
     }
-    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+    if ((cs = get_stmt(mdb, STMT_UNINDEX_PROJECT)) == NULL){
+        rollback_savepoint(mdb);
+        return SQLITE_ERROR;
+    }
+    sqlite3_bind_text(cs->stmt, cs->params[0], project, -1, SQLITE_STATIC);
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
     }
     if (e != SQLITE_DONE){
-        cleanup(e, stmt, db);
+        cleanup(e, cs->stmt, mdb);
+        rollback_savepoint(mdb);
         return e;
     }
-    sqlite3_finalize(stmt);
-    return 0;
+    if ((cs = get_stmt(db, STMT_OPEN_STARTS)) == NULL){
+        rollback_savepoint(mdb);
+        return SQLITE_ERROR;
+    }
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+        if ((add = get_stmt(mdb, STMT_ADD_OPEN_SESSION)) == NULL){
+            e = SQLITE_ERROR;
+            break;
+        }
+        sqlite3_bind_text(add->stmt, add->params[0], project, -1, SQLITE_STATIC);
+        sqlite3_bind_int(add->stmt, add->params[1], sqlite3_column_int(cs->stmt, 0));
+        sqlite3_bind_int64(add->stmt, add->params[2], sqlite3_column_int64(cs->stmt, 1));
+        if ((e = sqlite3_step(add->stmt)) != SQLITE_DONE){
+            cleanup(e, add->stmt, mdb);
+            break;
+        }
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, cs->stmt, db);
+        rollback_savepoint(mdb);
+        return e;
+    }
+    if ((cs = get_stmt(mdb, STMT_MARK_INDEXED)) == NULL){
+        rollback_savepoint(mdb);
+        return SQLITE_ERROR;
+    }
+    sqlite3_bind_text(cs->stmt, cs->params[0], project, -1, SQLITE_STATIC);
+    while ((e = sqlite3_step(cs->stmt)) == SQLITE_ROW){
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, cs->stmt, mdb);
+        rollback_savepoint(mdb);
+        return e;
+    }
+    return release_savepoint(mdb);
 }
 
-// start_task() starts a specified task. It will throw an error if the task is
-// currently active or does not exist.
-int start_task(sqlite3 *db, int id){
+// index_clock() brings the master db's index up to date after a clock event
+// has committed. The index is written in a transaction of its own after the
+// project's, on a connection only opened then, so clock events in different
+// projects don't wait on each other, a clock which fails never reaches it,
+// and commands which don't clock never touch the master db. The two commits
+// are not atomic: if the index can't be written, or the process dies between
+// them, the index is out of step until the project's next clock event or
+// 'qlock reconcile'.
+// A clock inside a transaction of the caller's leaves the index alone.
+static void index_clock(sqlite3 *db){
+    if (!sqlite3_get_autocommit(db)){
+        return;
+    }
+    if (sync_session_index(db) != SQLITE_OK){
+        fprintf(stderr, "Could not update the index of open sessions; run 'qlock reconcile' to rebuild it.\n");
+    }
+}
+
+// open_session() opens a session for task #id starting at now, inside a
+// savepoint the caller holds. The existence and state of the task are checked
+// by the insert itself: it inserts nothing for a task which doesn't exist, and
+// the sessions_open index, which allows only one open session per task, fails
+// it for a task which is already open.
+static int open_session(sqlite3 *db, int id, time_t now){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
     int e;
+    int n = 0;
 
-    if (task_exists(db, id) != 1){
-        return TASK_NOT_EXIST;
+    if ((cs = get_stmt(db, STMT_START_SESSION)) == NULL){
+        return TASK_ERROR;
     }
-    if (task_is_open(db, id) != 0){
+    stmt = cs->stmt;
+    sqlite3_bind_int(stmt, cs->params[0], id);
+    sqlite3_bind_int64(stmt, cs->params[1], now);
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        n++;
+    }
+    if (e == SQLITE_CONSTRAINT){
+        release_stmt(db, stmt);
         return TASK_WRONG_STATE;
     }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return TASK_ERROR;
+    }
+    if (n == 0){
+        return TASK_NOT_EXIST;
+    }
+    return TASK_OK;
+}
+
+// close_session() ends the open session of task #id at now and adds it to the
+// daily rollup, inside a savepoint the caller holds. Only when there is no
+// open session to end is the task looked up, to tell which error applies.
+static int close_session(sqlite3 *db, int id, time_t now){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    time_t start = 0;
+    int e;
+    int n = 0;
 
-    e = stamp_task(db, id);
-    return e;
+    if ((cs = get_stmt(db, STMT_END_SESSION)) == NULL){
+        return TASK_ERROR;
+    }
+    stmt = cs->stmt;
+    sqlite3_bind_int(stmt, cs->params[0], id);
+    sqlite3_bind_int64(stmt, cs->params[1], now);
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        start = sqlite3_column_int64(stmt, 0);
+        n++;
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, db);
+        return TASK_ERROR;
+    }
+    if (n == 0){
+        if ((e = task_exists(db, id)) < 0){
+            return TASK_ERROR;
+        }
+        return e ? TASK_WRONG_STATE : TASK_NOT_EXIST;
+    }
+    return (credit_session(db, id, start, now) == SQLITE_OK) ? TASK_OK : TASK_ERROR;
+}
+
+// start_task() starts a specified task by opening a new session for it. It
+// will throw an error if the task is currently active or does not exist.
+int start_task(sqlite3 *db, int id){
+    return clock_tasks(db, NULL, 0, &id, 1, NULL);
 }
 
-// end_task() ends a specified task. It will throw an error if the task is not
-// currently active or does not exist.
+// end_task() ends a specified task by closing its open session, and adds the
+// session to the daily rollup in the same transaction. It will throw an error
+// if the task is not currently active or does not exist.
 int end_task(sqlite3 *db, int id){
+    return clock_tasks(db, &id, 1, NULL, 0, NULL);
+}
+
+// clock_tasks() ends the nout tasks in outs and then starts the nin tasks in
+// ins, all in one transaction and at one timestamp, so switching between tasks
+// leaves no gap or overlap between them. If any task can't be clocked nothing
+// is, and failed is set to its position in outs followed by ins, or to -1 if
+// the error wasn't down to one task. Returns TASK_OK, the TASK_STATE of the
+// task which failed, or TASK_ERROR if the db could not be read or written.
+int clock_tasks(sqlite3 *db, int *outs, int nout, int *ins, int nin, int *failed){
+    time_t now = time(NULL);
     int e;
 
-    if (task_exists(db, id) != 1){
-        return TASK_NOT_EXIST;
+    if (failed != NULL){
+        *failed = -1;
     }
-    if (task_is_open(db, id) != 1){
-        return TASK_WRONG_STATE;
+    if (begin_savepoint(db) != SQLITE_OK){
+        return TASK_ERROR;
+    }
+    for (int i = 0; i < nout + nin; i++){
+        if (i < nout){
+            e = close_session(db, outs[i], now);
+        } else{
+            e = open_session(db, ins[i-nout], now);
+        }
+        if (e != TASK_OK){
+            if (failed != NULL){
+                *failed = i;
+            }
+            rollback_savepoint(db);
+            return e;
+        }
     }
+    if (release_savepoint(db) != SQLITE_OK){
+        return TASK_ERROR;
+    }
+    index_clock(db);
+    return TASK_OK;
+}
 
-    e = stamp_task(db, id);
-    return e;
+// end_all_tasks() ends every open task at one timestamp, closing all of their
+// sessions with a single update. ids is set to a malloc'd array of the tasks
+// ended. Returns the number of tasks ended, or -1 on error.
+int end_all_tasks(sqlite3 *db, int **ids){
+    struct cached_stmt *cs;
+    sqlite3_stmt *stmt;
+    time_t now = time(NULL);
+    int *o = NULL;
+    int *tmp;
+    int e, id;
+    int n = 0;
+    int cap = 0;
+
+    if (begin_savepoint(db) != SQLITE_OK){
+        return -1;
+    }
+    if ((cs = get_stmt(db, STMT_END_ALL_SESSIONS)) == NULL){
+        rollback_savepoint(db);
+        return -1;
+    }
+    stmt = cs->stmt;
+    sqlite3_bind_int64(stmt, cs->params[0], now);
+    // The update is done in full on the first step, and the rows it returns
+    // are read back from memory, so the rollups can be written in between
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+        id = sqlite3_column_int(stmt, 0);
+        if (n == cap){
+            cap = (cap == 0) ? 8 : cap*2;
+            if ((tmp = realloc(o, cap*sizeof(int))) == NULL){
+                break;
+            }
+            o = tmp;
+        }
+        o[n++] = id;
+        if (credit_session(db, id, sqlite3_column_int64(stmt, 1), now) != SQLITE_OK){
+            break;
+        }
+    }
+    if (e != SQLITE_DONE){
+        if (e == SQLITE_ROW){
+            sqlite3_reset(stmt);
+        } else{
+            cleanup(e, stmt, db);
+        }
+        free(o);
+        rollback_savepoint(db);
+        return -1;
+    }
+    if (release_savepoint(db) != SQLITE_OK){
+        free(o);
+        return -1;
+    }
+    index_clock(db);
+    *ids = o;
+    return n;
 }
@@ -1,8 +1,12 @@
 #include <sqlite3.h>
 
-typedef enum {TASK_OK, TASK_NOT_EXIST, TASK_WRONG_STATE} TASK_STATE;
+// TASK_ERROR is a failure to read or write the db rather than anything about
+// the task
+typedef enum {TASK_OK, TASK_NOT_EXIST, TASK_WRONG_STATE, TASK_ERROR} TASK_STATE;
 
 int create_task(sqlite3 *db, char *name, char *desc);
-int stamp_task(sqlite3 *db, int id);
 int start_task(sqlite3 *db, int id);
 int end_task(sqlite3 *db, int id);
+int clock_tasks(sqlite3 *db, int *outs, int nout, int *ins, int nin, int *failed);
+int end_all_tasks(sqlite3 *db, int **ids);
+int sync_session_index(sqlite3 *db);
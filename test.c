@@ -1,15 +1,26 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "project.h"
 #include "tasks.h"
 #include "task_utils.h"
+#include "db.h"
+#include "migrate.h"
+#include "import.h"
+#include "export.h"
+#include "trace.h"
+#include "arena.h"
+#include "days.h"
+#include "report.h"
 
 struct test_results{
     int p;
@@ -20,7 +31,8 @@ int clear_db(sqlite3 *tdb){
     sqlite3_stmt *stmt;
     int e;
     char *delete_info_table = "DELETE FROM task_info";
-    char *delete_ts_table = "DELETE FROM task_ts";
+    char *delete_ts_table = "DELETE FROM sessions";
+    char *delete_daily_table = "DELETE FROM task_daily";
 
     e = sqlite3_prepare_v2(tdb, delete_info_table, -1, &stmt, NULL);
     if (e != SQLITE_OK){
@@ -47,6 +59,18 @@ int clear_db(sqlite3 *tdb){
         return e;
     }
     sqlite3_finalize(stmt);
+    e = sqlite3_prepare_v2(tdb, delete_daily_table, -1, &stmt, NULL);
+    if (e != SQLITE_OK){
+        cleanup(e, stmt, tdb);
+        return e;
+    }
+    while ((e = sqlite3_step(stmt)) == SQLITE_ROW){
+    }
+    if (e != SQLITE_DONE){
+        cleanup(e, stmt, tdb);
+        return e;
+    }
+    sqlite3_finalize(stmt);
 
     return 0;
 }
@@ -100,6 +124,19 @@ void teststr(int (*cmp)(char*, char*), char *a, char *b, struct test_results *tr
     fprintf(stderr, "\e[39m");
 }
 
+// count_rows() returns the single integer result of a query
+int count_rows(sqlite3 *tdb, char *query){
+    sqlite3_stmt *stmt;
+    int n = -1;
+
+    sqlite3_prepare_v2(tdb, query, -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW){
+        n = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return n;
+}
+
 struct test_results test_tasksH(sqlite3 *tdb){
     struct test_results tr = {0, 0};
 
@@ -110,6 +147,7 @@ struct test_results test_tasksH(sqlite3 *tdb){
     char *desc = calloc(1000000, 1);
     memset(desc, 'A', 70);
     test(neq, create_task(tdb, "Long description", desc), -1, &tr, "Create task with very long description"); // TODO: This test_eq passes but the description is not truncated. There's really no reason to actually truncate anything so probably should just remove that restriction anyway
+    free(desc);
 
     clear_db(tdb);
     // Test task starting/stopping
@@ -122,10 +160,194 @@ struct test_results test_tasksH(sqlite3 *tdb){
     start_task(tdb, 1);
     test(eq, start_task(tdb, 1), TASK_WRONG_STATE, &tr, "Start a task which has already been started");
 
+    clear_db(tdb);
+    // Test clocking several tasks at once
+    int ids[3] = {1, 2, 3};
+    int *ended = NULL;
+    int failed = -1;
+    create_task(tdb, "", "");
+    create_task(tdb, "", "");
+    create_task(tdb, "", "");
+    test(eq, clock_tasks(tdb, NULL, 0, ids, 3, &failed), TASK_OK, &tr, "Start three tasks at once");
+    test(eq, count_rows(tdb, "SELECT COUNT(DISTINCT start) FROM sessions;"), 1, &tr, "Tasks started together should share a timestamp");
+    test(eq, clock_tasks(tdb, ids, 2, ids+2, 1, &failed), TASK_WRONG_STATE, &tr, "Swapping into an open task should fail");
+    test(eq, failed, 2, &tr, "The task which could not be started should be reported");
+    test(eq, task_is_open(tdb, 1), 1, &tr, "A failed swap should not end any task");
+    test(eq, clock_tasks(tdb, ids, 1, NULL, 0, &failed), TASK_OK, &tr, "End a task as a batch of one");
+    test(eq, clock_tasks(tdb, ids, 1, ids+1, 1, &failed), TASK_WRONG_STATE, &tr, "Swapping out of a closed task should fail");
+    test(eq, failed, 0, &tr, "The task which could not be ended should be reported");
+    test(eq, end_all_tasks(tdb, &ended), 2, &tr, "End every open task");
+    test(eq, ended[0] + ended[1], 5, &tr, "The ended tasks should be reported");
+    free(ended);
+    test(eq, count_rows(tdb, "SELECT COUNT(*) FROM sessions WHERE end IS NULL;"), 0, &tr, "No task should be open after ending them all");
+    test(eq, end_all_tasks(tdb, &ended), 0, &tr, "Ending every task when none are open should end none");
+    free(ended);
+
+    // A failed write is an error of its own, not a state of the task
+    start_task(tdb, 1);
+    sqlite3_exec(tdb, "CREATE TEMP TRIGGER fail_rollup BEFORE INSERT ON task_daily BEGIN SELECT RAISE(ABORT, 'no rollups'); END;",
+                 NULL, NULL, NULL);
+    test(eq, clock_tasks(tdb, ids, 1, NULL, 0, &failed), TASK_ERROR, &tr, "A failed rollup should fail the clock as an error");
+    test(eq, task_is_open(tdb, 1), 1, &tr, "A clock which failed to write should change nothing");
+    sqlite3_exec(tdb, "DROP TRIGGER fail_rollup;", NULL, NULL, NULL);
+
     clear_db(tdb);
     return tr;
 }
 
+// elapsed_days collects the days of an elapsed breakdown for checking
+struct elapsed_days{
+    int n;
+    struct day_elapsed days[8];
+};
+
+int collect_day(struct day_elapsed *d, void *ctx){
+    struct elapsed_days *ed = ctx;
+
+    if (ed->n < 8){
+        ed->days[ed->n] = *d;
+    }
+    ed->n++;
+    return 0;
+}
+
+int stop_after_day(struct day_elapsed *d, void *ctx){
+    collect_day(d, ctx);
+    return 1;
+}
+
+// local_ts() returns the timestamp of a local time on the given day
+time_t local_ts(int year, int mon, int mday, int hr, int min){
+    struct tm t = {0};
+
+    t.tm_year = year-1900;
+    t.tm_mon = mon-1;
+    t.tm_mday = mday;
+    t.tm_hour = hr;
+    t.tm_min = min;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+// insert_stamp() adds a timestamp for task #id at a fixed time, ending its
+// open session if it has one and starting a new session otherwise
+void insert_stamp(sqlite3 *tdb, int id, time_t ts){
+    char sql[128];
+
+    sprintf(sql, "UPDATE sessions SET end=%lld WHERE task_id=%d AND end IS NULL;", (long long)ts, id);
+    sqlite3_exec(tdb, sql, NULL, NULL, NULL);
+    if (sqlite3_changes(tdb) == 0){
+        sprintf(sql, "INSERT INTO sessions (task_id, start) VALUES (%d, %lld);", id, (long long)ts);
+        sqlite3_exec(tdb, sql, NULL, NULL, NULL);
+    }
+}
+
+struct test_results test_elapsedH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct elapsed_days ed = {0};
+    char query[128];
+    int id, n;
+
+    id = create_task(tdb, "elapsed", "");
+    test(eq, get_elapsed_breakdown(tdb, id, collect_day, &ed), 0, &tr, "Breakdown of a task with no stamps");
+    test(eq, ed.n, 0, &tr, "A task with no stamps should have no days");
+
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 10, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 11, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 12, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 12, 30));
+    insert_stamp(tdb, id, local_ts(2020, 3, 3, 9, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 3, 9, 15));
+    ed.n = 0;
+    get_elapsed_breakdown(tdb, id, collect_day, &ed);
+    test(eq, ed.n, 0, &tr, "Sessions added outside of end_task() should not be in the rollups");
+    test(eq, rebuild_rollups(tdb), SQLITE_OK, &tr, "Rebuild the daily rollups");
+    ed.n = 0;
+    test(eq, get_elapsed_breakdown(tdb, id, collect_day, &ed), 0, &tr, "Breakdown of a task over two days");
+    test(eq, ed.n, 2, &tr, "The task should have two days");
+    test(eq, ed.days[0].mday, 2, &tr, "The first day should be the 2nd");
+    test(eq, ed.days[0].seconds, 5400, &tr, "The first day should have an hour and a half");
+    test(eq, ed.days[1].mday, 3, &tr, "The second day should be the 3rd");
+    test(eq, ed.days[1].seconds, 900, &tr, "The second day should have fifteen minutes");
+    ed.n = 0;
+    get_elapsed_breakdown(tdb, id, stop_after_day, &ed);
+    test(eq, ed.n, 1, &tr, "Returning nonzero from the callback should stop the breakdown");
+
+    insert_stamp(tdb, id, time(NULL)-60);
+    ed.n = 0;
+    get_elapsed_breakdown(tdb, id, collect_day, &ed);
+    test(eq, ed.n, 3, &tr, "An open session should add a day");
+    test(eq, ed.days[2].seconds >= 60, 1, &tr, "An open session should count up to now");
+
+    // Sessions closed by end_task() should be rolled up without a rebuild
+    id = create_task(tdb, "rolled up", "");
+    start_task(tdb, id);
+    end_task(tdb, id);
+    start_task(tdb, id);
+    end_task(tdb, id);
+    ed.n = 0;
+    get_elapsed_breakdown(tdb, id, collect_day, &ed);
+    test(eq, ed.n, 1, &tr, "Sessions closed today should be rolled up into one day");
+    sprintf(query, "SELECT COUNT(*) FROM task_daily WHERE task_id=%d;", id);
+    test(eq, count_rows(tdb, query), 1, &tr, "There should be one rollup row per task and day");
+    sprintf(query, "SELECT seconds FROM task_daily WHERE task_id=%d;", id);
+    n = count_rows(tdb, query);
+    rebuild_rollups(tdb);
+    test(eq, count_rows(tdb, query), n, &tr, "Rebuilding should give the same rollups");
+
+    // Time ranges are read from the stamps and clipped to the window
+    id = create_task(tdb, "ranged", "");
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 10, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 11, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 12, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 2, 12, 30));
+    insert_stamp(tdb, id, local_ts(2020, 3, 3, 9, 0));
+    insert_stamp(tdb, id, local_ts(2020, 3, 3, 9, 15));
+    insert_stamp(tdb, id, local_ts(2020, 3, 4, 23, 0));
+    ed.n = 0;
+    test(eq, get_elapsed_range(tdb, id, local_ts(2020, 3, 2, 0, 0), local_ts(2020, 3, 3, 0, 0), collect_day, &ed), 0, &tr, "Breakdown of a single day");
+    test(eq, ed.n, 1, &tr, "A one day window should have one day");
+    test(eq, ed.days[0].seconds, 5400, &tr, "Sessions inside the window should count in full");
+    ed.n = 0;
+    get_elapsed_range(tdb, id, local_ts(2020, 3, 2, 10, 30), local_ts(2020, 3, 3, 9, 10), collect_day, &ed);
+    test(eq, ed.n, 2, &tr, "A window over two days should have two days");
+    test(eq, ed.days[0].seconds, 3600, &tr, "A session crossing the start of the window should be clipped");
+    test(eq, ed.days[1].seconds, 600, &tr, "A session crossing the end of the window should be clipped");
+    ed.n = 0;
+    get_elapsed_range(tdb, id, local_ts(2020, 3, 5, 0, 0), local_ts(2020, 3, 6, 0, 0), collect_day, &ed);
+    test(eq, ed.n, 1, &tr, "An open session started before the window should count in it");
+    test(eq, ed.days[0].seconds, local_ts(2020, 3, 6, 0, 0) - local_ts(2020, 3, 5, 0, 0), &tr, "An open session should cover the whole window");
+    ed.n = 0;
+    get_elapsed_range(tdb, id, time(NULL) - 3600, time(NULL) + 3600, collect_day, &ed);
+    test(eq, ed.days[0].seconds >= 3599 && ed.days[0].seconds <= 3601, 1, &tr, "An open session should count up to now and no further");
+    ed.n = 0;
+    get_elapsed_range(tdb, id, local_ts(2020, 3, 3, 0, 0), local_ts(2020, 3, 2, 0, 0), collect_day, &ed);
+    test(eq, ed.n, 0, &tr, "An empty window should have no days");
+    ed.n = 0;
+    get_elapsed_range(tdb, id, local_ts(2020, 3, 2, 10, 30), local_ts(2020, 3, 3, 9, 10), stop_after_day, &ed);
+    test(eq, ed.n, 1, &tr, "Returning nonzero from the callback should stop the range");
+    test(eq, get_elapsed_range(tdb, 1000, 0, time(NULL), collect_day, &ed), -1, &tr, "The range of a nonexistant task should fail");
+
+    clear_db(tdb);
+    return tr;
+}
+
+// record_task() records the ids of visited tasks in an array whose first
+// element counts them
+int record_task(struct task_row *t, void *ctx){
+    int *seen = ctx;
+
+    if (seen[0] < 3){
+        seen[++seen[0]] = t->id;
+    }
+    return 0;
+}
+
+int stop_at_task(struct task_row *t, void *ctx){
+    record_task(t, ctx);
+    return 1;
+}
+
 struct test_results test_task_utilsH(sqlite3 *tdb){
     struct test_results tr = {0, 0};
 
@@ -140,21 +362,81 @@ struct test_results test_task_utilsH(sqlite3 *tdb){
     test(eq, task_is_open(tdb, 1), 1, &tr, "Test if an open task is open.");
     test(eq, get_num_timestamps(tdb, 1), 1, &tr, "Test if the number of timestamps of the task is 1");
     end_task(tdb, 1);
-    create_task(tdb, "", "");
+    create_task(tdb, "second", "");
     start_task(tdb, 2);
     end_task(tdb, 2);
-    test(eq, print_elapsed_breakdown(tdb, 2), 0, &tr, "Test if printing elapsed breakdown returns 0.");
+    struct elapsed_days ed = {0};
+    test(eq, get_elapsed_breakdown(tdb, 2, collect_day, &ed), 0, &tr, "Test if the elapsed breakdown returns 0.");
+    test(eq, ed.n, 1, &tr, "Test if a task stamped today has one day of elapsed time.");
+    test(eq, get_elapsed_breakdown(tdb, 100, collect_day, &ed), -1, &tr, "Test if the elapsed breakdown of a nonexistant task fails.");
     start_task(tdb, 1);
     start_task(tdb, 2);
-    int *o;
-    test(eq, get_open_tasks(tdb, &o), 2, &tr, "Test if two tasks are open");
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    int n;
+    test(eq, (n = get_open_tasks(tdb, &a, &o)), 2, &tr, "Test if two tasks are open");
+    test(eq, o[1].id, 2, &tr, "Test if open tasks are returned in id order");
+    teststr(streq, o[1].name, "second", &tr, "Test if open tasks are returned with their names");
+    arena_reset(&a);
     end_task(tdb, 1);
+    test(eq, (n = get_open_tasks(tdb, &a, &o)), 1, &tr, "Test if one task is open");
+    test(eq, o[0].id, 2, &tr, "Test if the remaining open task is the second one");
+    arena_reset(&a);
     end_task(tdb, 2);
-    test(eq, get_open_tasks(tdb, &o), 0, &tr, "Test if no tasks are open");
+    test(eq, get_open_tasks(tdb, &a, &o), 0, &tr, "Test if no tasks are open");
+    create_task(tdb, "third", "third description");
+    test(eq, (n = get_all_tasks(tdb, &a, &o)), 3, &tr, "Test if all three tasks are listed");
+    test(eq, o[2].id, 3, &tr, "Test if all tasks are listed in id order");
+    teststr(streq, o[2].name, "third", &tr, "Test if listed tasks have their names");
+    teststr(streq, o[2].desc, "third description", &tr, "Test if listed tasks have their descriptions");
+    arena_free(&a);
+    int seen[4] = {0};
+    test(eq, each_task(tdb, TASKS_ALL, record_task, seen), 3, &tr, "Test if every task is visited");
+    test(eq, seen[0] == 3 && seen[3] == 3, 1, &tr, "Test if tasks are visited in id order");
+    seen[0] = 0;
+    test(eq, each_task(tdb, TASKS_ALL, stop_at_task, seen), 1, &tr, "Test if returning nonzero stops the visit");
+    test(eq, each_task(tdb, TASKS_ALL, record_task, seen), 3, &tr, "Test if a stopped visit can be run again");
+    start_task(tdb, 3);
+    seen[0] = 0;
+    test(eq, each_task(tdb, TASKS_OPEN, record_task, seen), 1, &tr, "Test if only open tasks are visited");
+    test(eq, seen[1], 3, &tr, "Test if the open task is visited");
+    struct open_total *ot;
+    sqlite3_exec(tdb, "DELETE FROM sessions WHERE task_id=3; INSERT INTO sessions VALUES (3, 1000, 1100), (3, 2000, NULL);", NULL, NULL, NULL);
+    rebuild_rollups(tdb);
+    test(eq, get_open_totals(tdb, &a, &ot), 1, &tr, "Test if only open tasks get totals");
+    test(eq, ot[0].id == 3 && ot[0].start == 2000, 1, &tr, "Test if an open total has the start of the open session");
+    test(eq, (int)ot[0].closed, 100, &tr, "Test if an open total has the time of the finished sessions");
+    teststr(streq, ot[0].name, "third", &tr, "Test if open totals have their names");
+    arena_free(&a);
+    end_task(tdb, 3);
+
+    sqlite3 *other;
+    long long v = get_data_version(tdb);
+    test(neq, (int)v, -1, &tr, "Test if the data version can be read");
+    create_task(tdb, "own write", "");
+    test(eq, get_data_version(tdb) == v, 1, &tr, "Test if the data version ignores the connection's own writes");
+    sqlite3_open(sqlite3_db_filename(tdb, "main"), &other);
+    test(eq, get_data_version(tdb) == v, 1, &tr, "Test if the data version ignores other connections' reads");
+    sqlite3_exec(other, "INSERT INTO task_info (name) VALUES ('other write');", NULL, NULL, NULL);
+    test(eq, get_data_version(tdb) != v, 1, &tr, "Test if the data version changes on another connection's write");
+    close_db(other);
 
     return tr;
 }
 
+int stop_at_project(char *name, void *ctx){
+    return 1;
+}
+
+// active_name_is() returns 1 if the active project is called name
+int active_name_is(sqlite3 *tmdb, char *name){
+    char *active = get_active_project_name(tmdb);
+    int found = (active != NULL && streq(active, name));
+
+    free(active);
+    return found;
+}
+
 struct test_results test_projectH(sqlite3 *tdb, sqlite3 *tmdb, char *tmdb_path){
     struct test_results tr = {0, 0};
 
@@ -165,23 +447,1002 @@ struct test_results test_projectH(sqlite3 *tdb, sqlite3 *tmdb, char *tmdb_path){
     remove(".db"); // Shouldn't really be needed
 
     create_master_db(&tmdb, tmdb_path);
-    teststr(streq, get_active_project_name(tmdb), "temp", &tr, "Active name should be 'temp'");
+    test(eq, active_name_is(tmdb, "temp"), 1, &tr, "Active name should be 'temp'");
     test(eq, create_project(tdb, tmdb, "np"), 0, &tr, "Create a new project");
     test(eq, create_project(tdb, tmdb, "np"), -2, &tr, "Create a duplicate project");
     test(eq, create_project(tdb, tmdb, ""), -1, &tr, "Create a project with an empty name");
-    teststr(streq, get_active_project_name(tmdb), "np", &tr, "Active project name should be 'np'");
+    test(eq, active_name_is(tmdb, "np"), 1, &tr, "Active project name should be 'np'");
+    struct arena a = {NULL, 0};
+    char **names;
+    test(eq, get_all_projects(tmdb, &a, &names), 2, &tr, "Both projects should be listed");
+    test(eq, streq(names[0], "np") || streq(names[1], "np"), 1, &tr, "Listed projects should have their names");
+    arena_free(&a);
+    test(eq, each_project(tmdb, stop_at_project, NULL), 1, &tr, "Returning nonzero should stop visiting projects");
     switch_active_project(tmdb, "temp");
-    teststr(streq, get_active_project_name(tmdb), "temp", &tr, "Active name should be 'temp'");
+    test(eq, active_name_is(tmdb, "temp"), 1, &tr, "Active name should be 'temp'");
     switch_active_project(tmdb, "nonexistant");
-    teststr(streq, get_active_project_name(tmdb), "temp", &tr, "Active name should still be 'temp' since switching to nonexistant project should fail");
+    test(eq, active_name_is(tmdb, "temp"), 1, &tr, "Active name should still be 'temp' since switching to nonexistant project should fail");
     test(eq, project_exists(tmdb, "np"), 1, &tr, "Project should exist.");
     test(eq, project_exists(tmdb, "nonexist"), 0, &tr, "Project should not exist.");
     remove("np.db");
 
+    char *cache_path = "./.test/.active";
+    char *cached;
+    remove(cache_path);
+    test(eq, read_active_cache(cache_path, tmdb_path) == NULL, 1, &tr, "A missing active cache should give no name");
+    test(eq, write_active_cache(cache_path, "np", tmdb_path), 0, &tr, "Write the active cache");
+    cached = read_active_cache(cache_path, tmdb_path);
+    teststr(streq, cached, "np", &tr, "The active cache should give back the written name");
+    free(cached);
+    write_active_cache(cache_path, "temp", tmdb_path);
+    cached = read_active_cache(cache_path, tmdb_path);
+    teststr(streq, cached, "temp", &tr, "Rewriting the active cache should replace the name");
+    free(cached);
+    switch_active_project(tmdb, "np");
+    test(eq, read_active_cache(cache_path, tmdb_path) == NULL, 1, &tr,
+         "A switch the active cache never saw should make it give no name");
+    test(eq, write_active_cache(cache_path, "np", "./.test/.nomdb.db"), -1, &tr,
+         "The active cache should not be written without a master db");
+    remove(cache_path);
+
     remove(tmdb_path);
     return tr;
 }
 
+// index_exists() returns 1 if the db has an index of the given name
+int index_exists(sqlite3 *db, char *name){
+    sqlite3_stmt *stmt;
+    int n = 0;
+
+    sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master WHERE type='index' AND name=?1;", -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) == SQLITE_ROW){
+        n = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return n;
+}
+
+struct test_results test_arenaH(void){
+    struct test_results tr = {0, 0};
+    struct arena a = {NULL, 0};
+    char *s, *big;
+    int *v, *w;
+
+    s = arena_strndup(&a, "hello world", 5);
+    teststr(streq, s, "hello", &tr, "A copied string should be cut to its length");
+    teststr(streq, arena_strndup(&a, NULL, 0), "", &tr, "Copying a NULL column should give an empty string");
+    v = arena_alloc(&a, 3*sizeof(int));
+    test(eq, (int)((size_t)v % sizeof(union arena_align)), 0, &tr, "Allocations should be aligned");
+    v[0] = 7;
+    w = arena_grow(&a, v, 3*sizeof(int), 64*sizeof(int));
+    test(eq, w == v, 1, &tr, "The latest allocation should grow in place");
+    w[63] = 1;
+    s = arena_alloc(&a, 1);
+    w = arena_grow(&a, v, 64*sizeof(int), 128*sizeof(int));
+    test(eq, w != v && w[0] == 7, 1, &tr, "An allocation which can't grow in place should be copied");
+    test(eq, a.blocks, 1, &tr, "Small allocations should share one block");
+    big = arena_alloc(&a, 3*ARENA_BLOCK_SZ);
+    memset(big, 'x', 3*ARENA_BLOCK_SZ);
+    test(eq, a.blocks, 2, &tr, "An allocation bigger than a block should get a block of its own");
+    arena_reset(&a);
+    test(eq, a.head != NULL && a.head->next == NULL && a.head->used == 0, 1, &tr, "Resetting should merge the blocks into one");
+    test(eq, a.head->cap >= 4*ARENA_BLOCK_SZ, 1, &tr, "The merged block should be as large as the blocks it replaces");
+    arena_alloc(&a, ARENA_BLOCK_SZ);
+    arena_alloc(&a, 3*ARENA_BLOCK_SZ);
+    test(eq, a.blocks, 3, &tr, "Allocating as much again after a reset should need no new block");
+    arena_reset(&a);
+    test(eq, a.blocks, 3, &tr, "Resetting a single block should not replace it");
+    arena_free(&a);
+    test(eq, a.head == NULL, 1, &tr, "Freeing should leave the arena empty");
+
+    return tr;
+}
+
+struct test_results test_migrateH(char *legacy_path){
+    struct test_results tr = {0, 0};
+    sqlite3 *ldb = NULL;
+    int id;
+    char *legacy_schema = "CREATE TABLE task_info (id INTEGER PRIMARY KEY, name TEXT NOT NULL, description TEXT);"
+                          "CREATE TABLE task_ts (id INTEGER NOT NULL, timestamp INTEGER NOT NULL, FOREIGN KEY(id) REFERENCES task_info(id));"
+                          "INSERT INTO task_info VALUES (1, 'old', 'from before migrations');"
+                          "INSERT INTO task_ts VALUES (1, 100);"
+                          "INSERT INTO task_ts VALUES (1, 160);"
+                          "INSERT INTO task_ts VALUES (1, 200);";
+
+    remove(legacy_path);
+    sqlite3_open(legacy_path, &ldb);
+    sqlite3_exec(ldb, legacy_schema, NULL, NULL, NULL);
+    test(eq, get_schema_version(ldb), 0, &tr, "A project made before migrations should be at version 0");
+    test(eq, migrate_project_db(ldb), SQLITE_OK, &tr, "Migrate a project made before migrations");
+    test(eq, get_schema_version(ldb), PROJECT_DB_VERSION, &tr, "A migrated project should be at the latest version");
+    test(eq, index_exists(ldb, "sessions_open"), 1, &tr, "A migrated project should have the open session index");
+    test(eq, count_rows(ldb, "SELECT COUNT(*) FROM sqlite_schema WHERE name='task_ts';"), 0, &tr, "Migrating should drop the timestamp table");
+    test(eq, get_num_timestamps(ldb, 1), 3, &tr, "Migrating should keep existing timestamps");
+    test(eq, count_rows(ldb, "SELECT end-start FROM sessions WHERE task_id=1 AND end IS NOT NULL;"), 60, &tr, "Migrating should pair stamps into sessions");
+    test(eq, task_is_open(ldb, 1), 1, &tr, "A leftover stamp should become an open session");
+    test(eq, find_task(ldb, "ol", &id), 1, &tr, "Tasks made before migrations should be searchable");
+    test(eq, count_rows(ldb, "SELECT seconds FROM task_daily WHERE task_id=1;"), 60, &tr, "Migrating should roll up existing sessions");
+    test(eq, migrate_project_db(ldb), SQLITE_OK, &tr, "Migrating an up to date project should do nothing");
+    sqlite3_exec(ldb, "PRAGMA user_version=1000;", NULL, NULL, NULL);
+    test(neq, migrate_project_db(ldb), SQLITE_OK, &tr, "Migrating a project from a newer version should fail");
+    close_db(ldb);
+    remove(legacy_path);
+
+    sqlite3_open(legacy_path, &ldb);
+    test(eq, migrate_master_db(ldb), SQLITE_OK, &tr, "Migrate an empty master database");
+    test(eq, get_schema_version(ldb), MASTER_DB_VERSION, &tr, "A migrated master database should be at the latest version");
+    test(eq, project_exists(ldb, "temp"), 0, &tr, "The migrated master database should have a project table");
+    close_db(ldb);
+    remove(legacy_path);
+
+    return tr;
+}
+
+// first_match() records the id of the best match of a search
+int first_match(struct task_row *t, void *ctx){
+    *(int*)ctx = t->id;
+    return 1;
+}
+
+struct test_results test_searchH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    int seen[4] = {0};
+    int a, b, c, id;
+
+    a = create_task(tdb, "Write report", "quarterly numbers");
+    b = create_task(tdb, "Review code", "the report generator");
+    c = create_task(tdb, "review-docs", "");
+    test(eq, search_tasks(tdb, "rep", 10, record_task, seen), 2, &tr, "A search should match word prefixes in names and descriptions");
+    test(eq, seen[1], a, &tr, "A match in the name should rank above one in the description");
+    seen[0] = 0;
+    test(eq, search_tasks(tdb, "QUART", 10, record_task, seen), 1, &tr, "A search should ignore case");
+    test(eq, seen[1], a, &tr, "A search should match descriptions");
+    test(eq, search_tasks(tdb, "rev gen", 10, record_task, seen), 1, &tr, "A search should match every word of the query");
+    test(eq, search_tasks(tdb, "\"*) OR NEAR(", 10, record_task, seen), 0, &tr, "FTS5 syntax in a query should be taken literally");
+    test(eq, search_tasks(tdb, "  ", 10, record_task, seen), 0, &tr, "An empty query should match nothing");
+    test(eq, search_tasks(tdb, "r", 10, record_task, seen), 3, &tr, "A one letter query should match word prefixes");
+    test(eq, search_tasks(tdb, "r q n", 10, record_task, seen), 1, &tr, "A query of one letter words should match every word");
+    test(eq, search_tasks(tdb, "\"\"\"\" \"", 10, record_task, seen), 0, &tr, "A query of quotes should match nothing");
+    test(eq, search_tasks(tdb, "re", 1, record_task, seen), 1, &tr, "A search should stop at its limit");
+    test(eq, search_tasks(tdb, "re", 10, first_match, &id), 1, &tr, "Returning nonzero should stop a search");
+    sqlite3_exec(tdb, "UPDATE task_info SET name='Draft summary' WHERE id=1;", NULL, NULL, NULL);
+    test(eq, search_tasks(tdb, "write", 10, record_task, seen), 0, &tr, "A renamed task should not match its old name");
+    test(eq, search_tasks(tdb, "draft", 10, first_match, &id), 1, &tr, "A renamed task should match its new name");
+
+    test(eq, find_task(tdb, "rev", &id), -2, &tr, "A prefix of two names should be ambiguous");
+    test(eq, find_task(tdb, "review-", &id), 1, &tr, "Punctuation in a prefix should narrow the match");
+    test(eq, id, c, &tr, "The task whose name starts with the prefix should be found");
+    test(eq, find_task(tdb, "REVIEW C", &id), 1, &tr, "A prefix should ignore case");
+    test(eq, id, b, &tr, "A prefix of several words should be found");
+    test(eq, find_task(tdb, "code", &id), 0, &tr, "A word in the middle of a name should not match a prefix");
+    test(eq, find_task(tdb, "generator", &id), 0, &tr, "A prefix should not match descriptions");
+    create_task(tdb, "Review code again", "");
+    test(eq, find_task(tdb, "review code", &id), 1, &tr, "An exact name should be picked over longer ones");
+    test(eq, id, b, &tr, "The exactly named task should be found");
+    create_task(tdb, "%_", "");
+    test(eq, find_task(tdb, "%", &id), 1, &tr, "A prefix without words should be found by a scan");
+    test(eq, find_task(tdb, "_", &id), 0, &tr, "LIKE wildcards in a prefix should be taken literally");
+    sqlite3_exec(tdb, "DELETE FROM task_info WHERE id=3;", NULL, NULL, NULL);
+    test(eq, find_task(tdb, "review-", &id), 0, &tr, "A deleted task should not be found");
+    clear_db(tdb);
+
+    return tr;
+}
+
+// day_pieces records the days a span was split into
+struct day_pieces{
+    int n;
+    int keys[8];
+    long long secs[8];
+};
+
+int record_piece(int key, long long secs, void *ctx){
+    struct day_pieces *p = ctx;
+
+    if (p->n < 8){
+        p->keys[p->n] = key;
+        p->secs[p->n] = secs;
+    }
+    p->n++;
+    return 0;
+}
+
+// split_matches() checks the split of a span, given in whole minutes, against
+// one worked out by calling localtime() for every minute of it
+int split_matches(struct day_calendar *c, time_t start, time_t stop){
+    struct day_pieces got = {0};
+    struct day_pieces want = {0};
+
+    calendar_split(c, start, stop, record_piece, &got);
+    for (time_t t = start; t < stop; t += 60){
+        if (want.n == 0 || want.keys[want.n-1] != day_key(t)){
+            want.keys[want.n++] = day_key(t);
+        }
+        want.secs[want.n-1] += 60;
+    }
+    if (got.n != want.n){
+        return 0;
+    }
+    for (int i = 0; i < got.n; i++){
+        if (got.keys[i] != want.keys[i] || got.secs[i] != want.secs[i]){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// set_tz() switches the local timezone of the tests
+void set_tz(const char *tz){
+    if (tz == NULL){
+        unsetenv("TZ");
+    } else{
+        setenv("TZ", tz, 1);
+    }
+    tzset();
+}
+
+// local_time() returns the time of a local wall clock time in the current
+// timezone
+time_t local_time(int y, int mon, int d, int h, int min){
+    struct tm tm = {0};
+
+    tm.tm_year = y - 1900;
+    tm.tm_mon = mon - 1;
+    tm.tm_mday = d;
+    tm.tm_hour = h;
+    tm.tm_min = min;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+struct test_results test_daysH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct day_calendar cal = {NULL, NULL, 0, 0};
+    struct day_pieces p;
+    struct elapsed_days ed = {0};
+    char *old_tz = getenv("TZ") ? strdup(getenv("TZ")) : NULL;
+    char msg[96];
+    int id, ok;
+    // Zones with DST at 1 or 2am, a DST gap or overlap at midnight, a half
+    // hour shift, a skipped day and no DST at all
+    const char *zones[] = {"UTC", "Europe/London", "America/New_York", "America/Sao_Paulo",
+                           "America/Havana", "Australia/Lord_Howe", "Pacific/Apia", "Asia/Kolkata"};
+    // Transitions of those zones, in UTC
+    const time_t shifts[] = {1710054000, 1730613600, 1711846800, 1729990800, 1541300400,
+                             1550372400, 1583643600, 1604203200, 1325239200, 1712415600, 1728142200};
+    // Windows around each transition, in minutes before and after it
+    const int windows[][2] = {{30, 30}, {90, 17}, {1500, 1500}, {2887, 2881}};
+
+    for (size_t z = 0; z < sizeof(zones)/sizeof(zones[0]); z++){
+        set_tz(zones[z]);
+        ok = 1;
+        for (size_t s = 0; s < sizeof(shifts)/sizeof(shifts[0]); s++){
+            for (size_t w = 0; w < sizeof(windows)/sizeof(windows[0]); w++){
+                ok &= split_matches(&cal, shifts[s] - windows[w][0]*60, shifts[s] + windows[w][1]*60);
+            }
+        }
+        calendar_free(&cal);
+        sprintf(msg, "Splitting at midnight in %s should agree with localtime()", zones[z]);
+        test(eq, ok, 1, &tr, msg);
+    }
+
+    set_tz("Europe/London");
+    memset(&p, 0, sizeof(p));
+    calendar_split(&cal, local_time(2024, 3, 30, 12, 0), local_time(2024, 4, 1, 12, 0), record_piece, &p);
+    test(eq, p.n == 3 && p.secs[0] == 12*3600 && p.secs[2] == 12*3600, 1, &tr, "A two day session should be split into three days");
+    test(eq, (int)p.secs[1], 23*3600, &tr, "The day the clocks go forward should be 23 hours");
+    memset(&p, 0, sizeof(p));
+    calendar_split(&cal, local_time(2024, 10, 27, 0, 0), local_time(2024, 10, 28, 0, 0), record_piece, &p);
+    test(eq, p.n == 1 && p.secs[0] == 25*3600, 1, &tr, "The day the clocks go back should be 25 hours");
+    memset(&p, 0, sizeof(p));
+    calendar_split(&cal, local_time(2024, 6, 1, 9, 0), local_time(2024, 6, 1, 9, 0), record_piece, &p);
+    test(eq, p.n == 1 && p.keys[0] == 20240601 && p.secs[0] == 0, 1, &tr, "An empty span should still give its day");
+    calendar_find(&cal, local_time(2020, 1, 1, 12, 0));
+    calendar_find(&cal, local_time(2025, 1, 1, 12, 0));
+    ok = calendar_find(&cal, local_time(2023, 2, 28, 23, 59));
+    test(eq, ok >= 0 && cal.keys[ok] == 20230228 && cal.keys[ok+1] == 20230301, 1, &tr, "Days added on both sides should stay in order");
+    calendar_free(&cal);
+
+    set_tz("America/Sao_Paulo");
+    memset(&p, 0, sizeof(p));
+    calendar_split(&cal, local_time(2018, 11, 3, 12, 0), local_time(2018, 11, 5, 12, 0), record_piece, &p);
+    test(eq, p.n == 3 && p.keys[1] == 20181104 && p.secs[1] == 23*3600, 1, &tr, "A day starting in a DST gap should start when the clocks land");
+    calendar_free(&cal);
+
+    set_tz("Pacific/Apia");
+    memset(&p, 0, sizeof(p));
+    calendar_split(&cal, local_time(2011, 12, 29, 12, 0), local_time(2011, 12, 31, 12, 0), record_piece, &p);
+    test(eq, p.n == 2 && p.keys[0] == 20111229 && p.keys[1] == 20111231, 1, &tr, "A skipped day should get no time");
+    calendar_free(&cal);
+
+    set_tz("UTC");
+    id = create_task(tdb, "overnight", "");
+    sprintf(msg, "INSERT INTO sessions VALUES (%d, %d, %d);", id, 86400*20000 - 3600, 86400*20000 + 7200);
+    sqlite3_exec(tdb, msg, NULL, NULL, NULL);
+    rebuild_rollups(tdb);
+    sprintf(msg, "SELECT COUNT(*) FROM task_daily WHERE task_id=%d;", id);
+    test(eq, count_rows(tdb, msg), 2, &tr, "Rebuilding should credit a session over midnight to both days");
+    sprintf(msg, "SELECT seconds FROM task_daily WHERE task_id=%d AND day=%d;", id, day_key(86400*20000));
+    test(eq, count_rows(tdb, msg), 7200, &tr, "The day after should only get the time after midnight");
+    sqlite3_exec(tdb, "DELETE FROM task_daily;", NULL, NULL, NULL);
+    credit_session(tdb, id, 86400*20000 - 3600, 86400*20000 + 7200);
+    sprintf(msg, "SELECT seconds FROM task_daily WHERE task_id=%d AND day=%d;", id, day_key(86400*20000 - 1));
+    test(eq, count_rows(tdb, msg), 3600, &tr, "Ending a session should credit the day before with the time before midnight");
+    sprintf(msg, "INSERT INTO sessions VALUES (%d, %ld, NULL);", id, (long)(time(NULL) - 86400 - 60));
+    sqlite3_exec(tdb, msg, NULL, NULL, NULL);
+    get_elapsed_breakdown(tdb, id, collect_day, &ed);
+    test(eq, ed.n >= 2, 1, &tr, "An open session over midnight should be split");
+    clear_db(tdb);
+
+    set_tz(old_tz);
+    free(old_tz);
+    return tr;
+}
+
+// traced_count() returns how many times tracing saw SQL containing sql run
+long traced_count(const char *sql){
+    struct trace_stat *s;
+    long count = 0;
+    int n = trace_stats(&s);
+
+    for (int i = 0; i < n; i++){
+        if (strstr(s[i].sql, sql) != NULL){
+            count += s[i].count;
+        }
+    }
+    free(s);
+    return count;
+}
+
+struct test_results test_reportH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct project_report r, r1;
+    const char *path = sqlite3_db_filename(tdb, "main");
+    char sql[128];
+    int ok = 1;
+    char *old_tz = getenv("TZ") ? strdup(getenv("TZ")) : NULL;
+    int n = 3*REPORT_CHUNK + 5;
+    long long sum;
+
+    set_tz("UTC");
+    sqlite3_exec(tdb, "BEGIN;", NULL, NULL, NULL);
+    for (int i = 1; i <= n; i++){
+        create_task(tdb, "reported", "");
+        // Task i gets i minutes on each of i%3 days
+        for (int k = 0; k < i%3; k++){
+            sprintf(sql, "INSERT INTO sessions VALUES (%d, %d, %d);", i, 86400*(19000 + k) + 3600, 86400*(19000 + k) + 3600 + 60*i);
+            sqlite3_exec(tdb, sql, NULL, NULL, NULL);
+        }
+    }
+    sqlite3_exec(tdb, "COMMIT;", NULL, NULL, NULL);
+    rebuild_rollups(tdb);
+
+    set_tracing(1);
+    test(eq, report_project((char*)path, 4, &r), n, &tr, "Every task should be in the report");
+    set_tracing(0);
+    test(eq, (int)traced_count("FROM task_daily WHERE task_id=@id"), n, &tr, "Tracing should count every worker's statements");
+    trace_reset();
+    for (int i = 0; i < r.num_tasks; i++){
+        ok &= (r.tasks[i].id == i+1);
+    }
+    test(eq, ok, 1, &tr, "The report should be in id order");
+    for (int i = 0; i < r.num_tasks; i++){
+        ok &= (r.tasks[i].num_days == (i+1)%3 && r.tasks[i].total == 60LL*(i+1)*((i+1)%3));
+    }
+    test(eq, ok, 1, &tr, "Every task should have its days and total");
+    test(eq, report_project((char*)path, 1, &r1), n, &tr, "A report with one worker should have every task");
+    sum = 0;
+    for (int i = 0; i < r1.num_tasks; i++){
+        sum += (r1.tasks[i].total == r.tasks[i].total);
+    }
+    test(eq, (int)sum, n, &tr, "The number of workers should not change the report");
+    report_free(&r);
+    report_free(&r1);
+    test(eq, r.num_tasks == 0 && r.arenas == NULL, 1, &tr, "Freeing a report should leave it empty");
+    test(eq, report_project("./.test/missing.db", 2, &r), -1, &tr, "Reporting on a missing project should fail");
+    clear_db(tdb);
+    set_tz(old_tz);
+    free(old_tz);
+
+    return tr;
+}
+
+struct test_results test_report_allH(char *mdb_path){
+    struct test_results tr = {0, 0};
+    struct all_report r, r1;
+    sqlite3 *mdb = NULL;
+    sqlite3 *db = NULL;
+    sqlite3 *old[2];
+    char name[64];
+    char sql[128];
+    char *legacy_schema = "CREATE TABLE task_info (id INTEGER PRIMARY KEY, name TEXT NOT NULL, description TEXT);"
+                          "CREATE TABLE task_ts (id INTEGER NOT NULL, timestamp INTEGER NOT NULL, FOREIGN KEY(id) REFERENCES task_info(id));"
+                          "INSERT INTO task_info (name, description) VALUES ('legacy', '');"
+                          "INSERT INTO task_ts VALUES (1, 100);"
+                          "INSERT INTO task_ts VALUES (1, 160);";
+    int ok = 1;
+    int np = 12;
+    time_t now = time(NULL);
+
+    create_master_db(&mdb, mdb_path);
+    // Projects are reported in name order, which puts the temp project the
+    // master db starts out with last. Project p has p tasks, task t of which has t minutes, and the last
+    // task of project 1 is left clocked in
+    for (int p = 0; p < np; p++){
+        sprintf(name, "./.test/.all%02d", p);
+        create_project(db, mdb, name);
+        sprintf(name, "./.test/.all%02d.db", p);
+        open_db(name, &db, SQLITE_OPEN_READWRITE);
+        for (int t = 1; t <= p; t++){
+            create_task(db, "summed", "");
+            sprintf(sql, "INSERT INTO sessions VALUES (%d, %d, %d);", t, 1700000000, 1700000000 + 60*t);
+            sqlite3_exec(db, sql, NULL, NULL, NULL);
+        }
+        rebuild_rollups(db);
+        if (p == 1){
+            sprintf(sql, "INSERT INTO sessions VALUES (1, %lld, NULL);", (long long)now - 100);
+            sqlite3_exec(db, sql, NULL, NULL, NULL);
+        }
+        close_db(db);
+    }
+    sqlite3_exec(mdb, "INSERT INTO proj_info (name, active) VALUES ('./.test/.nodb', 0);", NULL, NULL, NULL);
+
+    test(eq, report_all(mdb, 4, &r), np+2, &tr, "Every project should be in the report");
+    for (int p = 0; p < np; p++){
+        sprintf(name, "./.test/.all%02d", p);
+        ok &= (strcmp(r.projects[p].name, name) == 0 && !r.projects[p].missing && r.projects[p].num_tasks == p);
+    }
+    test(eq, ok, 1, &tr, "Projects should be in the order they are listed, with all their tasks");
+    for (int p = 2; p < np; p++){
+        for (int t = 0; t < p; t++){
+            ok &= (r.projects[p].tasks[t].id == t+1 && r.projects[p].tasks[t].seconds == 60LL*(t+1));
+        }
+        ok &= (r.projects[p].total == 30LL*p*(p+1));
+    }
+    test(eq, ok, 1, &tr, "Every task should have the time of its sessions");
+    test(eq, r.projects[1].tasks[0].seconds >= 160 && r.projects[1].tasks[0].seconds < 260, 1, &tr,
+         "An open session should count up to the report");
+    test(eq, r.projects[np].missing && r.projects[np].num_tasks == 0, 1, &tr, "A project without a db should be missing");
+    test(eq, report_all(mdb, 1, &r1), np+2, &tr, "A report with one worker should have every project");
+    test(eq, (int)(r1.total - r1.projects[1].total), (int)(r.total - r.projects[1].total), &tr,
+         "The number of workers should not change the report");
+    all_report_free(&r);
+    all_report_free(&r1);
+    test(eq, r.num_projects == 0 && r.arenas == NULL, 1, &tr, "Freeing a report should leave it empty");
+
+    // A project db from before this qlock is upgraded for the report, and one
+    // which can't be is marked outdated rather than failing the report
+    for (int i = 0; i < 2; i++){
+        sprintf(name, "./.test/.allold%s.db", i ? "2" : "");
+        sqlite3_open(name, &old[i]);
+        sqlite3_exec(old[i], legacy_schema, NULL, NULL, NULL);
+        sprintf(sql, "INSERT INTO proj_info (name, active) VALUES ('./.test/.allold%s', 0);", i ? "2" : "");
+        sqlite3_exec(mdb, sql, NULL, NULL, NULL);
+    }
+    sqlite3_exec(old[1], "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    setenv("QLOCK_BUSY_TIMEOUT", "10", 1);
+    test(eq, report_all(mdb, 4, &r), np+4, &tr, "A report should have the projects with old dbs");
+    unsetenv("QLOCK_BUSY_TIMEOUT");
+    test(eq, !r.projects[np].outdated && r.projects[np].num_tasks == 1 && r.projects[np].total == 60, 1, &tr,
+         "An old project db should be upgraded for the report");
+    test(eq, r.projects[np+1].outdated && r.projects[np+1].num_tasks == 0, 1, &tr,
+         "A project db which can't be upgraded should be marked outdated");
+    all_report_free(&r);
+    sqlite3_exec(old[1], "ROLLBACK;", NULL, NULL, NULL);
+    for (int i = 0; i < 2; i++){
+        sqlite3_close(old[i]);
+    }
+    remove("./.test/.allold.db");
+    remove("./.test/.allold2.db");
+
+    close_db(mdb);
+    for (int p = 0; p < np; p++){
+        // The last connection to each was read-only, which leaves its wal
+        sprintf(name, "./.test/.all%02d.db", p);
+        remove(name);
+        strcat(name, "-wal");
+        remove(name);
+        strcpy(name + strlen(name) - 3, "shm");
+        remove(name);
+    }
+    remove(mdb_path);
+    return tr;
+}
+
+// index_collector records the entries of the open session index as they are
+// visited
+struct index_collector{
+    int n;
+    int ids[8];
+    int named;
+    const char *project;
+};
+
+// collect_open_session() records a visited open session
+int collect_open_session(struct open_session *s, void *ctx){
+    struct index_collector *c = ctx;
+
+    if (c->n < 8){
+        c->ids[c->n] = s->id;
+    }
+    c->named += streq(s->project, (char*)c->project);
+    c->n++;
+    return 0;
+}
+
+// indexed() lists the open session index into c and returns its length
+int indexed(sqlite3 *mdb, struct index_collector *c, const char *project){
+    memset(c, 0, sizeof(*c));
+    c->project = project;
+    each_open_session(mdb, collect_open_session, c);
+    return c->n;
+}
+
+struct test_results test_open_sessionsH(char *mdb_path){
+    struct test_results tr = {0, 0};
+    struct index_collector c;
+    sqlite3 *mdb = NULL;
+    sqlite3 *db = NULL;
+    sqlite3 *old = NULL;
+    sqlite3 *other = NULL;
+    char sql[256];
+    char *name = "./.test/.indexed";
+    char *path = "./.test/.indexed.db";
+    char *old_path = "./.test/.oldmdb.db";
+    char *legacy_name = "./.test/.unindexed";
+    char *legacy_schema = "CREATE TABLE task_info (id INTEGER PRIMARY KEY, name TEXT NOT NULL, description TEXT);"
+                          "CREATE TABLE task_ts (id INTEGER NOT NULL, timestamp INTEGER NOT NULL, FOREIGN KEY(id) REFERENCES task_info(id));"
+                          "INSERT INTO task_info (name, description) VALUES ('legacy', '');"
+                          "INSERT INTO task_ts VALUES (1, 100);";
+    char *legacy;
+    int *ids = NULL;
+    int outs[] = {2};
+    int ins[] = {9};
+
+    create_master_db(&mdb, mdb_path);
+    create_project(NULL, mdb, name);
+    open_db(path, &db, SQLITE_OPEN_READWRITE);
+    test(eq, set_index_project(db, mdb_path, name), 0, &tr, "The master db should be named for the project");
+    test(eq, get_index_db(db) == NULL, 1, &tr, "Naming the master db should not open it");
+    for (int i = 0; i < 3; i++){
+        create_task(db, "indexed", "");
+    }
+    start_task(db, 1);
+    start_task(db, 2);
+    test(eq, indexed(mdb, &c, name), 2, &tr, "Starting tasks should index their sessions");
+    test(eq, c.named == 2 && c.ids[0] == 1 && c.ids[1] == 2, 1, &tr, "Indexed sessions should be listed by project and id");
+    test(eq, start_task(db, 1), TASK_WRONG_STATE, &tr, "Starting an open task should fail");
+    test(eq, indexed(mdb, &c, name), 2, &tr, "A failed start should not touch the index");
+    end_task(db, 1);
+    test(eq, indexed(mdb, &c, name) == 1 && c.ids[0] == 2, 1, &tr, "Ending a task should drop its session from the index");
+    test(eq, clock_tasks(db, outs, 1, ins, 1, NULL), TASK_NOT_EXIST, &tr, "Swapping to a missing task should fail");
+    test(eq, indexed(mdb, &c, name) == 1 && c.ids[0] == 2, 1, &tr, "A failed swap should roll the index back");
+    end_all_tasks(db, &ids);
+    free(ids);
+    test(eq, indexed(mdb, &c, name), 0, &tr, "Ending every task should empty the index");
+    begin_savepoint(db);
+    test(eq, sqlite3_exec(mdb, "BEGIN IMMEDIATE; COMMIT;", NULL, NULL, NULL), SQLITE_OK, &tr,
+         "A clock transaction should not hold the master db's lock");
+    rollback_savepoint(db);
+    start_task(db, 1);
+    sqlite3_exec(mdb, "DELETE FROM open_sessions;", NULL, NULL, NULL);
+    start_task(db, 2);
+    test(eq, indexed(mdb, &c, name), 2, &tr, "A clock should bring the project's whole index up to date");
+    end_all_tasks(db, &ids);
+    free(ids);
+
+    start_task(db, 3);
+    sqlite3_exec(mdb, "DELETE FROM open_sessions; INSERT INTO open_sessions VALUES ('gone', 1, 0);", NULL, NULL, NULL);
+    test(eq, reconcile_open_sessions(mdb), 1, &tr, "Reconciling should index every open session");
+    test(eq, indexed(mdb, &c, name) == 1 && c.named == 1 && c.ids[0] == 3, 1, &tr,
+         "Reconciling should rebuild the index from the project files");
+
+    // A master db from before the index is left alone until it is upgraded,
+    // after which each project is indexed as it is next clocked
+    open_db(old_path, &old, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    sprintf(sql, "CREATE TABLE proj_info (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL, active INTEGER NOT NULL);"
+            "INSERT INTO proj_info (name, active) VALUES ('%s', 1); PRAGMA user_version=1;", name);
+    sqlite3_exec(old, sql, NULL, NULL, NULL);
+    open_db(path, &other, SQLITE_OPEN_READWRITE);
+    set_index_project(other, old_path, name);
+    test(eq, start_task(other, 1), TASK_OK, &tr, "A clock should succeed with an old master db");
+    test(eq, get_index_path(other) == NULL && get_schema_version(old) == 1, 1, &tr, "An old master db should not be indexed");
+    end_task(other, 1);
+    close_db(other);
+    open_db(path, &other, SQLITE_OPEN_READWRITE);
+    set_index_project(other, "./.test/.nomdb.db", name);
+    test(eq, start_task(other, 1), TASK_OK, &tr, "A clock should succeed without a master db");
+    test(eq, access("./.test/.nomdb.db", F_OK), -1, &tr, "A missing master db should not be created");
+    end_task(other, 1);
+    close_db(other);
+    // A project file from before the sessions table, like any not opened
+    // since qlock was upgraded, must not keep the master db from upgrading
+    legacy = sqlite3_mprintf("%s.db", legacy_name);
+    remove(legacy);
+    open_db(legacy, &other, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    sqlite3_exec(other, legacy_schema, NULL, NULL, NULL);
+    close_db(other);
+    sprintf(sql, "INSERT INTO proj_info (name, active) VALUES ('%s', 0);", legacy_name);
+    sqlite3_exec(old, sql, NULL, NULL, NULL);
+    test(eq, migrate_master_db(old), SQLITE_OK, &tr, "Upgrade an old master db with an old project file");
+    test(eq, indexed(old, &c, name), 0, &tr, "Upgrading should not read the project files");
+    test(eq, count_unindexed_projects(old), 2, &tr, "Upgrading should leave every project to be indexed");
+    open_db(legacy, &other, SQLITE_OPEN_READWRITE);
+    migrate_project_db(other);
+    set_index_project(other, old_path, legacy_name);
+    create_task(other, "new", "");
+    test(eq, indexed(old, &c, legacy_name), 0, &tr, "Opening a project should not index it");
+    start_task(other, 2);
+    test(eq, indexed(old, &c, legacy_name) == 2 && c.named == 2 && c.ids[0] == 1 && c.ids[1] == 2, 1, &tr,
+         "A clock should index every open session of its project");
+    test(eq, count_unindexed_projects(old), 1, &tr, "A clock should mark its project indexed");
+    close_db(other);
+
+    remove(legacy);
+    open_db(legacy, &other, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    sqlite3_exec(other, legacy_schema, NULL, NULL, NULL);
+    close_db(other);
+    test(eq, reconcile_open_sessions(old), 2, &tr, "Reconciling should upgrade old project files");
+    open_db(legacy, &other, SQLITE_OPEN_READONLY);
+    test(eq, get_schema_version(other), PROJECT_DB_VERSION, &tr, "Reconciling should leave the project files upgraded");
+    close_db(other);
+    test(eq, count_unindexed_projects(old), 0, &tr, "Reconciling should mark every project indexed");
+
+    close_db(old);
+    remove(legacy);
+    sqlite3_free(legacy);
+    close_db(db);
+    close_db(mdb);
+    remove(old_path);
+    remove(path);
+    remove(mdb_path);
+    return tr;
+}
+
+// import_string() imports the given text as if it were read from a file
+int import_string(sqlite3 *tdb, char *text, struct import_stats *st){
+    FILE *f = tmpfile();
+    int e;
+
+    fputs(text, f);
+    rewind(f);
+    e = import_tasks(tdb, f, st);
+    fclose(f);
+    return e;
+}
+
+// task_name_is() returns 1 if task #id has the given name
+int task_name_is(sqlite3 *tdb, int id, char *name){
+    struct arena a = {NULL, 0};
+    struct task_row *o;
+    int n, found = 0;
+
+    n = get_all_tasks(tdb, &a, &o);
+    for (int i = 0; i < n; i++){
+        if (o[i].id == id){
+            found = streq(o[i].name, name);
+        }
+    }
+    arena_free(&a);
+    return found;
+}
+
+struct test_results test_importH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct import_stats st;
+    struct elapsed_days ed = {0};
+
+    test(eq, import_string(tdb, "id,name,description,timestamp\n"
+                                "1,csv task,plain,1583157600\n"
+                                "1,csv task,plain,1583161200\n"
+                                "2,\"quoted, \"\"name\"\"\",\"two\nlines\",\r\n", &st), 0, &tr, "Import CSV");
+    test(eq, st.tasks, 2, &tr, "Two tasks should be imported from the CSV");
+    test(eq, st.stamps, 2, &tr, "Two timestamps should be imported from the CSV");
+    test(eq, task_name_is(tdb, 2, "quoted, \"name\""), 1, &tr, "Quoted CSV fields should be unescaped");
+    get_elapsed_breakdown(tdb, 1, collect_day, &ed);
+    test(eq, ed.days[0].seconds, 3600, &tr, "Imported sessions should be rolled up");
+
+    test(eq, import_string(tdb, "{\"id\": 3, \"name\": \"json \\\"task\\\" \\u00e9\", \"description\": null, \"timestamp\": 1583157600}\n"
+                                "\n"
+                                "{\"id\":3,\"timestamp\":1583158600}\n"
+                                "{\"id\":1,\"timestamp\":1583200000,\"extra\":true}\n"
+                                "{\"id\":1,\"timestamp\":1583200100}\n", &st), 0, &tr, "Import NDJSON");
+    test(eq, st.tasks, 1, &tr, "One new task should be imported from the NDJSON");
+    test(eq, st.stamps, 4, &tr, "Four timestamps should be imported from the NDJSON");
+    test(eq, task_name_is(tdb, 3, "json \"task\" \xc3\xa9"), 1, &tr, "JSON strings should be unescaped");
+    test(eq, get_num_timestamps(tdb, 1), 4, &tr, "Stamps should be added to existing tasks");
+
+    test(eq, import_string(tdb, "\xEF\xBB\xBFid,name\n5,bom\n", &st) == 0 && task_name_is(tdb, 5, "bom"), 1, &tr,
+         "A byte order mark should be skipped");
+    test(eq, import_string(tdb, "\xEF,id,name\n,6,not bom\n", &st) == 0 && task_name_is(tdb, 6, "not bom"), 1, &tr,
+         "Input starting with 0xEF but no byte order mark should be read as it is");
+    test(neq, import_string(tdb, "id,name,timestamp\n4,failed,\n1,csv task,1583200050\n", &st), 0, &tr,
+         "Importing an open session which overlaps an existing one should fail");
+    test(eq, task_exists(tdb, 4), 0, &tr, "A failed import should add nothing");
+    test(eq, import_string(tdb, "id,name,timestamp\n4,odd,1583157600\n4,odd,1583157700\n4,odd,1583157800\n", &st), 0, &tr,
+         "Import an odd number of stamps");
+    test(eq, task_is_open(tdb, 4), 1, &tr, "An odd last stamp should clock its task in");
+    test(eq, count_rows(tdb, "SELECT COUNT(*) FROM sessions WHERE task_id=4 AND end IS NULL AND start=1583157800;"), 1, &tr,
+         "The open session should start at the last stamp");
+    end_task(tdb, 4);
+    test(neq, import_string(tdb, "id,timestamp\n9,1583157600\n9,1583157700\n", &st), 0, &tr, "Importing stamps of a nonexistant task should fail");
+    test(neq, import_string(tdb, "{\"id\":1,\"timestamp\":[1]}\n", &st), 0, &tr, "Importing malformed JSON should fail");
+    start_task(tdb, 1);
+    test(neq, import_string(tdb, "id,timestamp\n1,1583157600\n1,1583157700\n", &st), 0, &tr, "Importing stamps into an open task should fail");
+    test(eq, get_num_timestamps(tdb, 1), 5, &tr, "A failed import should not change existing stamps");
+    end_task(tdb, 1);
+
+    // Only the imported sessions are credited, so rollups of sessions which
+    // are already there are left alone
+    sqlite3_exec(tdb, "UPDATE task_daily SET seconds=seconds+1 WHERE task_id=3;", NULL, NULL, NULL);
+    test(eq, import_string(tdb, "id,timestamp\n3,1583300000\n3,1583300060\n", &st), 0, &tr, "Import a session into a task with sessions");
+    test(eq, count_rows(tdb, "SELECT SUM(seconds) FROM task_daily WHERE task_id=3;"), 1061, &tr,
+         "Importing should credit only the imported sessions");
+    test(neq, import_string(tdb, "id,timestamp\n3,1583300030\n3,1583300090\n", &st), 0, &tr,
+         "Importing a session which overlaps an existing one should fail");
+    test(neq, import_string(tdb, "id,timestamp\n3,1583300000\n3,1583300060\n", &st), 0, &tr,
+         "Importing the same session twice should fail");
+    test(eq, get_num_timestamps(tdb, 3), 4, &tr, "A refused overlap should add nothing");
+    test(eq, import_string(tdb, "id,timestamp\n3,1583300060\n3,1583300120\n", &st), 0, &tr,
+         "A session which starts as another ends should be imported");
+
+    clear_db(tdb);
+    return tr;
+}
+
+// read_all() reads a file from the start into buf
+void read_all(FILE *f, char *buf, size_t sz){
+    size_t n;
+
+    rewind(f);
+    n = fread(buf, 1, sz-1, f);
+    buf[n] = '\0';
+}
+
+struct test_results test_exportH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct import_stats st;
+    sqlite3 *old;
+    char buf[1024];
+    FILE *f;
+
+    import_string(tdb, "id,name,description,timestamp\n"
+                       "1,\"a, \"\"b\"\"\",\"line\nbreak\",100\n"
+                       "1,\"a, \"\"b\"\"\",\"line\nbreak\",160\n"
+                       "2,empty,,\n", &st);
+
+    f = tmpfile();
+    export_header(EXPORT_CSV, f);
+    test(eq, export_project(tdb, "proj", EXPORT_CSV, f), 3, &tr, "Export a row per stamp and one for a task without stamps");
+    read_all(f, buf, sizeof(buf));
+    teststr(streq, buf, "project,id,name,description,timestamp\n"
+                        "proj,1,\"a, \"\"b\"\"\",\"line\nbreak\",100\n"
+                        "proj,1,\"a, \"\"b\"\"\",\"line\nbreak\",160\n"
+                        "proj,2,empty,,\n", &tr, "CSV export should quote fields which need it");
+    fclose(f);
+
+    f = tmpfile();
+    export_project(tdb, "proj", EXPORT_NDJSON, f);
+    read_all(f, buf, sizeof(buf));
+    teststr(streq, buf, "{\"project\":\"proj\",\"id\":1,\"name\":\"a, \\\"b\\\"\",\"description\":\"line\\nbreak\",\"timestamp\":100}\n"
+                        "{\"project\":\"proj\",\"id\":1,\"name\":\"a, \\\"b\\\"\",\"description\":\"line\\nbreak\",\"timestamp\":160}\n"
+                        "{\"project\":\"proj\",\"id\":2,\"name\":\"empty\",\"description\":\"\",\"timestamp\":null}\n", &tr, "NDJSON export should escape strings");
+
+    // The export should import back into an empty project unchanged
+    clear_db(tdb);
+    rewind(f);
+    test(eq, import_tasks(tdb, f, &st), 0, &tr, "Import an NDJSON export");
+    test(eq, st.tasks, 2, &tr, "Both exported tasks should be imported");
+    test(eq, st.stamps, 2, &tr, "Both exported stamps should be imported");
+    test(eq, task_name_is(tdb, 1, "a, \"b\""), 1, &tr, "Exported names should import unchanged");
+    fclose(f);
+
+    // A session still open exports its start, which imports back as open
+    start_task(tdb, 2);
+    f = tmpfile();
+    export_header(EXPORT_CSV, f);
+    test(eq, export_project(tdb, "proj", EXPORT_CSV, f), 3, &tr, "An open session should export its start");
+    clear_db(tdb);
+    rewind(f);
+    test(eq, import_tasks(tdb, f, &st) == 0 && st.tasks == 2 && st.stamps == 3, 1, &tr,
+         "An export with an open session should import back");
+    test(eq, task_is_open(tdb, 2), 1, &tr, "An exported open session should import back open");
+    test(eq, task_is_open(tdb, 1), 0, &tr, "Exported finished sessions should import back finished");
+    fclose(f);
+    clear_db(tdb);
+    test(eq, import_string(tdb, "project,id,name,description,timestamp\n"
+                                "a,1,x,,100\n"
+                                "a,1,x,,160\n"
+                                "b,1,y,,200\n"
+                                "b,1,y,,260\n", &st), -1, &tr, "Records of several projects should not be imported");
+    test(eq, count_rows(tdb, "SELECT COUNT(*) FROM task_info;"), 0, &tr, "A refused import should add nothing");
+    test(eq, import_string(tdb, "{\"project\":\"a\",\"id\":1,\"name\":\"x\",\"timestamp\":100}\n"
+                                "{\"id\":1,\"timestamp\":160}\n"
+                                "{\"project\":\"a\",\"id\":2,\"name\":\"y\",\"timestamp\":null}\n", &st), 0, &tr,
+         "Records of one project should be imported");
+
+    // A project db from an older qlock is upgraded before it is exported
+    remove("./.test/.exportold.db");
+    sqlite3_open("./.test/.exportold.db", &old);
+    sqlite3_exec(old, "CREATE TABLE task_info (id INTEGER PRIMARY KEY, name TEXT NOT NULL, description TEXT);"
+                      "CREATE TABLE task_ts (id INTEGER NOT NULL, timestamp INTEGER NOT NULL, FOREIGN KEY(id) REFERENCES task_info(id));"
+                      "INSERT INTO task_info (name, description) VALUES ('legacy', '');"
+                      "INSERT INTO task_ts VALUES (1, 100);"
+                      "INSERT INTO task_ts VALUES (1, 160);", NULL, NULL, NULL);
+    sqlite3_close(old);
+    f = tmpfile();
+    test(eq, export_project_file("./.test/.exportold.db", "old", EXPORT_CSV, f), 2, &tr, "Export a project db from an older qlock");
+    read_all(f, buf, sizeof(buf));
+    teststr(streq, buf, "old,1,legacy,,100\nold,1,legacy,,160\n", &tr, "An old project db should export its stamps");
+    fclose(f);
+    f = fopen("./.test/.exportbad.db", "w");
+    fputs("not a database", f);
+    fclose(f);
+    f = tmpfile();
+    test(eq, export_project_file("./.test/.exportbad.db", "bad", EXPORT_CSV, f), -1, &tr, "Exporting an unreadable db should fail");
+    fclose(f);
+    remove("./.test/.exportold.db");
+    remove("./.test/.exportbad.db");
+
+    clear_db(tdb);
+    return tr;
+}
+
+struct test_results test_traceH(sqlite3 *tdb){
+    struct test_results tr = {0, 0};
+    struct arena a = {NULL, 0};
+    struct trace_stat *s;
+    struct task_row *o;
+    int n;
+    int found = -1;
+
+    clear_db(tdb);
+    create_task(tdb, "first", "");
+    create_task(tdb, "second", "");
+    trace_reset();
+    trace_attach(tdb, 1);
+    get_max_id(tdb);
+    get_max_id(tdb);
+    get_all_tasks(tdb, &a, &o);
+    arena_free(&a);
+    trace_attach(tdb, 0);
+    get_max_id(tdb);
+
+    n = trace_stats(&s);
+    test(eq, n, 2, &tr, "Two distinct statements should have been traced");
+    for (int i = 0; i < n; i++){
+        if (strcmp(s[i].sql, "SELECT MAX(id) FROM task_info;") == 0){
+            found = i;
+        }
+    }
+    test(neq, found, -1, &tr, "The max id statement should have been traced");
+    if (found >= 0){
+        test(eq, s[found].count, 2, &tr, "Runs after tracing stops should not be counted");
+        test(eq, s[found].rows, 2, &tr, "Each run of the max id statement steps one row");
+    }
+    for (int i = 0; i < n; i++){
+        if (strcmp(s[i].sql, "SELECT MAX(id) FROM task_info;") != 0){
+            test(eq, s[i].rows, 2, &tr, "Listing two tasks steps two rows");
+        }
+    }
+    free(s);
+    trace_reset();
+    n = trace_stats(&s);
+    test(eq, n, 0, &tr, "Resetting should forget every statement");
+    free(s);
+
+    // A clock event which succeeds checks and writes the session in one
+    // statement, and only a failed one looks the task up
+    trace_attach(tdb, 1);
+    start_task(tdb, 1);
+    end_task(tdb, 1);
+    test(eq, (int)traced_count("sessions"), 2, &tr, "Clocking in and out should run one statement on sessions each");
+    test(eq, (int)traced_count("SELECT COUNT(*) FROM task_info"), 0, &tr, "A clock event which succeeds should not look the task up");
+    test(eq, (int)traced_count("COMMIT"), 2, &tr, "Each clock event should commit once");
+    end_task(tdb, 1);
+    test(eq, (int)traced_count("SELECT COUNT(*) FROM task_info"), 1, &tr, "A failed clock event should look the task up");
+    trace_attach(tdb, 0);
+    trace_reset();
+    clear_db(tdb);
+
+    return tr;
+}
+
+// stress_clock() runs in a child of the concurrency test. It clocks task #id
+// in and out on a connection of its own once go is closed, then writes to fd how many clock ins
+// and outs succeeded and how many failed with an error.
+void stress_clock(char *path, int id, int rounds, int go, int fd){
+    sqlite3 *db;
+    int counts[3] = {0, 0, 0};
+    char c;
+    int e;
+
+    // Wait for the parent to let every child loose at once
+    read(go, &c, 1);
+    close(go);
+    if (open_db(path, &db, SQLITE_OPEN_READWRITE) != SQLITE_OK){
+        counts[2] = rounds;
+    } else{
+        for (int i = 0; i < rounds; i++){
+            if ((e = start_task(db, id)) == TASK_OK){
+                counts[0]++;
+            } else if (e != TASK_WRONG_STATE){
+                counts[2]++;
+            }
+            if ((e = end_task(db, id)) == TASK_OK){
+                counts[1]++;
+            } else if (e != TASK_WRONG_STATE){
+                counts[2]++;
+            }
+        }
+        close_db(db);
+    }
+    write(fd, counts, sizeof(counts));
+    close(fd);
+    _exit(0);
+}
+
+struct test_results test_concurrencyH(char *path){
+    struct test_results tr = {0, 0};
+    int nprocs = 6;
+    int rounds = 200;
+    int totals[3] = {0, 0, 0};
+    int counts[3];
+    int fds[2];
+    int readers[nprocs];
+    int go[2];
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    char mode[16] = "";
+    int id;
+
+    remove(path);
+    test(eq, open_db(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE), SQLITE_OK, &tr, "Open a db for the stress test");
+    migrate_project_db(db);
+    sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW){
+        snprintf(mode, sizeof(mode), "%s", (char*)sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    teststr(streq, mode, "wal", &tr, "Writable connections should use WAL journaling");
+    id = create_task(db, "contended", "clocked by every process");
+
+    // Every child races the others to clock the same task in and out
+    pipe(go);
+    for (int i = 0; i < nprocs; i++){
+        pipe(fds);
+        if (fork() == 0){
+            close(fds[0]);
+            close(go[1]);
+            stress_clock(path, id, rounds, go[0], fds[1]);
+        }
+        close(fds[1]);
+        readers[i] = fds[0];
+    }
+    close(go[0]);
+    close(go[1]);
+    for (int i = 0; i < nprocs; i++){
+        if (read(readers[i], counts, sizeof(counts)) == sizeof(counts)){
+            for (int j = 0; j < 3; j++){
+                totals[j] += counts[j];
+            }
+        } else{
+            totals[2] += rounds;
+        }
+        close(readers[i]);
+    }
+    while (wait(NULL) > 0){
+    }
+
+    test(eq, totals[2], 0, &tr, "No clock in or out should fail under contention");
+    test(eq, get_num_timestamps(db, id), totals[0] + totals[1], &tr, "There should be one stamp per successful clock in or out");
+    test(eq, totals[0] - totals[1], task_is_open(db, id), &tr, "Clock ins and outs should alternate");
+    close_db(db);
+    remove(path);
+    return tr;
+}
+
 int main(int argc, char **argv){
     sqlite3 *tdb = NULL;
     sqlite3 *tmdb = NULL;
@@ -221,6 +1482,66 @@ int main(int argc, char **argv){
     trt.n += tr.n;
     trt.p += tr.p;
 
+    tr = test_elapsedH(tdb);
+    fprintf(stderr, "\nelapsed: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_searchH(tdb);
+    fprintf(stderr, "\nsearch: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_daysH(tdb);
+    fprintf(stderr, "\ndays: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_reportH(tdb);
+    fprintf(stderr, "\nreport: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_report_allH("./.test/.allmdb.db");
+    fprintf(stderr, "\nreport_all: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_open_sessionsH("./.test/.indexmdb.db");
+    fprintf(stderr, "\nopen_sessions: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_importH(tdb);
+    fprintf(stderr, "\nimport: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_exportH(tdb);
+    fprintf(stderr, "\nexport: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_traceH(tdb);
+    fprintf(stderr, "\ntrace: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_arenaH();
+    fprintf(stderr, "\narena: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_migrateH("./.test/.legacy.db");
+    fprintf(stderr, "\nmigrate: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
+    tr = test_concurrencyH("./.test/.stress.db");
+    fprintf(stderr, "\nconcurrency: %d of %d tests passed.\n", tr.p, tr.n);
+    trt.n += tr.n;
+    trt.p += tr.p;
+
     char lines[64];
     char tot_msg[64];
     sprintf(tot_msg, "| Total: %d of %d tests passed. |", trt.p, trt.n);
@@ -228,8 +1549,8 @@ int main(int argc, char **argv){
     lines[strlen(tot_msg)] = '\0';
 
     // Cleanup
-    sqlite3_close(tdb);
-    sqlite3_close(tmdb);
+    close_db(tdb);
+    close_db(tmdb);
     remove(tdb_path);
     remove(tmdb_path);
     rmdir(temp_dir);
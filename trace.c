@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+#include "trace.h"
+#endif
+
+// The table is open addressed on a hash of the SQL text and never grows, so
+// statements past the first TRACE_SLOTS-1 distinct ones are lumped together
+#define TRACE_SLOTS 256
+#define TRACE_OVERFLOW "(other statements)"
+
+// The table is shared by every connection, which may be running on several
+// threads, so it is only touched with lock held. Runs of the same SQL on two
+// threads at once share a start time; the second to finish falls back on the
+// time sqlite measured for it.
+static struct trace_stat slots[TRACE_SLOTS];
+static double started[TRACE_SLOTS];
+static int num_slots = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Rows arrive one callback at a time, so the slot of the last statement seen
+// is kept to skip hashing its text again for every row
+static sqlite3_stmt *last_stmt = NULL;
+static struct trace_stat *last_slot = NULL;
+
+// hash_sql() is FNV-1a over the SQL text
+static unsigned hash_sql(const char *sql){
+    unsigned h = 2166136261u;
+
+    while (*sql){
+        h = (h ^ (unsigned char)*sql++) * 16777619u;
+    }
+    return h;
+}
+
+// find_slot() returns the slot of an SQL string, claiming a free one for a
+// string not seen before
+static struct trace_stat *find_slot(const char *sql){
+    unsigned i;
+
+    if (num_slots >= TRACE_SLOTS-1){
+        sql = TRACE_OVERFLOW;
+    }
+    for (i = hash_sql(sql)%TRACE_SLOTS; slots[i].sql != NULL; i = (i+1)%TRACE_SLOTS){
+        if (strcmp(slots[i].sql, sql) == 0){
+            return &slots[i];
+        }
+    }
+    if ((slots[i].sql = malloc(strlen(sql)+1)) == NULL){
+        return NULL;
+    }
+    strcpy(slots[i].sql, sql);
+    num_slots++;
+    return &slots[i];
+}
+
+// stmt_slot() returns the slot of a prepared statement's SQL
+static struct trace_stat *stmt_slot(sqlite3_stmt *stmt){
+    const char *sql;
+
+    if (stmt != last_stmt || last_slot == NULL){
+        if ((sql = sqlite3_sql(stmt)) == NULL){
+            return NULL;
+        }
+        last_slot = find_slot(sql);
+        last_stmt = stmt;
+    }
+    return last_slot;
+}
+
+// now_ms() returns a monotonic time in milliseconds
+static double now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+// trace_cb() is the sqlite3_trace_v2() callback. A statement event starts a
+// run of a statement and a profile event finishes it. Runs are timed between
+// the two, as the time sqlite passes with the profile event is only as fine
+// as its clock, which may be whole milliseconds.
+static int trace_cb(unsigned type, void *ctx, void *p, void *x){
+    struct trace_stat *s;
+    double *start;
+
+    pthread_mutex_lock(&lock);
+    if ((s = stmt_slot((sqlite3_stmt*)p)) == NULL){
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    start = &started[s - slots];
+    if (type == SQLITE_TRACE_STMT){
+        // Triggers fire this again mid-run with a comment for their text
+        if (strncmp((const char*)x, "--", 2) != 0){
+            *start = now_ms();
+        }
+    } else if (type == SQLITE_TRACE_PROFILE){
+        s->count++;
+        if (*start > 0){
+            s->ms += now_ms() - *start;
+            *start = 0;
+        } else{
+            s->ms += *(sqlite3_int64*)x/1e6;
+        }
+        // The run is over and the statement may be finalized, letting a
+        // new one take its address
+        last_stmt = NULL;
+    } else if (type == SQLITE_TRACE_ROW){
+        s->rows++;
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+// trace_attach() starts or stops recording the statements run on a connection
+void trace_attach(sqlite3 *db, int on){
+    if (on){
+        sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, trace_cb, NULL);
+    } else{
+        sqlite3_trace_v2(db, 0, NULL, NULL);
+    }
+}
+
+// cmp_stat() orders statements by the time spent in them, longest first
+static int cmp_stat(const void *a, const void *b){
+    double x = ((const struct trace_stat*)a)->ms;
+    double y = ((const struct trace_stat*)b)->ms;
+
+    return (x < y) - (x > y);
+}
+
+// trace_stats() puts a malloc'd copy of what has been recorded since the last
+// trace_reset() into o, longest running first. The SQL strings still belong
+// to the trace table. Returns the number of statements, or -1 on error.
+int trace_stats(struct trace_stat **o){
+    int n = 0;
+
+    pthread_mutex_lock(&lock);
+    if ((*o = malloc((num_slots+1)*sizeof(struct trace_stat))) == NULL){
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    for (int i = 0; i < TRACE_SLOTS; i++){
+        if (slots[i].sql != NULL){
+            (*o)[n++] = slots[i];
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    qsort(*o, n, sizeof(struct trace_stat), cmp_stat);
+    return n;
+}
+
+// trace_report() prints the wall time of a command followed by a table of
+// the statements it ran
+void trace_report(FILE *out, int argc, char **argv, double wall_ms){
+    struct trace_stat *s;
+    double sql_ms = 0;
+    int n;
+
+    fprintf(out, "trace:");
+    for (int i = 1; i < argc; i++){
+        fprintf(out, " %s", argv[i]);
+    }
+    if ((n = trace_stats(&s)) < 0){
+        fprintf(out, "\n");
+        return;
+    }
+    for (int i = 0; i < n; i++){
+        sql_ms += s[i].ms;
+    }
+    fprintf(out, " -- %.3f ms wall, %.3f ms in SQL\n", wall_ms, sql_ms);
+    fprintf(out, "%8s %12s %10s  %s\n", "count", "total ms", "rows", "sql");
+    for (int i = 0; i < n; i++){
+        fprintf(out, "%8ld %12.3f %10ld  %s\n", s[i].count, s[i].ms, s[i].rows, s[i].sql);
+    }
+    free(s);
+}
+
+// trace_reset() forgets everything recorded so far
+void trace_reset(void){
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < TRACE_SLOTS; i++){
+        free(slots[i].sql);
+    }
+    memset(slots, 0, sizeof(slots));
+    memset(started, 0, sizeof(started));
+    num_slots = 0;
+    last_stmt = NULL;
+    last_slot = NULL;
+    pthread_mutex_unlock(&lock);
+}
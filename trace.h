@@ -0,0 +1,15 @@
+#include <stdio.h>
+#include <sqlite3.h>
+
+// trace_stat holds what tracing saw of every run of one SQL string
+struct trace_stat{
+    char *sql;
+    long count;
+    long rows;
+    double ms;
+};
+
+void trace_attach(sqlite3 *db, int on);
+int trace_stats(struct trace_stat **o);
+void trace_report(FILE *out, int argc, char **argv, double wall_ms);
+void trace_reset(void);